@@ -69,6 +69,11 @@ let ignore_dead_code = ref false
 let ignore_equiv_appends = ref false
 let ignore_string_equiv_fixes = ref false
 let ignore_untyped_returns = ref false
+let split_compile = ref false
+let ignore_noop_edits = ref false
+let fault_scope = ref false
+let fault_scope_files = ref ""
+let reachable_from = ref ""
 
 let _ =
   options := !options @
@@ -99,12 +104,27 @@ let _ =
 
                "--ignore-untyped-returns", Arg.Set ignore_untyped_returns,
                " do not insert 'return' if the types mismatch." ;
+
+               "--ignore-noop-edits", Arg.Set ignore_noop_edits,
+               " do not make edits that cannot change the program." ;
+
+               "--split-compile", Arg.Set split_compile,
+               " compile only the edited functions of a single-file program." ;
+
+               "--fault-scope", Arg.Set fault_scope,
+               " keep only files with fault or fix atoms editable; compile the rest once." ;
+
+               "--fault-scope-files", Arg.Set_string fault_scope_files,
+               "X,Y also keep files X,Y editable with --fault-scope" ;
+
+               "--reachable-from", Arg.Set_string reachable_from,
+               "X,Y drop fault atoms in functions X,Y (e.g., main) cannot call" ;
              ]
 (**/**)
 
 (** {8 High-level CIL representation types/utilities } *)
 
-let cilRep_version = "17"
+let cilRep_version = "18"
 
 (** use CIL to parse a C file. This is called out as a utility function
     because CIL parser has global state hidden in the Errormsg module.
@@ -322,6 +342,57 @@ let in_scope_at varmap context_info moved_info =
   let in_scope = IntSet.union context_info.local_ids context_info.global_ids in
   check_available_vars varmap moved_info.usedvars in_scope
 
+(** Summary of a code bank statement, used by [--ignore-noop-edits] to
+    recognize edits that cannot change the program before they are made. *)
+type stmt_shape =
+  {
+    shape_key : Digest.t ;         (** digest of the statement, unlabeled *)
+    shape_empty : bool ;           (** the statement does nothing *)
+    shape_falls_through : bool ;   (** control may reach its end *)
+    shape_labeled : bool ;         (** some statement within it is labeled *)
+  }
+
+let rec stmt_is_empty s =
+  match s.skind with
+  | Instr [] -> true
+  | Block(b) -> List.for_all stmt_is_empty b.bstmts
+  | _ -> false
+
+let rec stmt_falls_through s =
+  match s.skind with
+  | Return _ | Goto _ | Break _ | Continue _ -> false
+  | Block(b) -> block_falls_through b
+  | If(_,b1,b2,_) -> block_falls_through b1 || block_falls_through b2
+  | _ -> true
+and block_falls_through b =
+  match lrev b.bstmts with
+  | [] -> true
+  | last :: _ -> stmt_falls_through last
+
+let stmt_shape s =
+  let stripped_stmt = {
+    labels = [] ; skind = s.skind ; sid = 0; succs = [] ; preds = [] ;
+  } in
+  let pretty_printed =
+    try
+      Pretty.sprint ~width:80 (Pretty.dprintf "%a" dn_stmt stripped_stmt)
+    with _ -> Printf.sprintf "@%d" s.sid
+  in
+  let labeled = ref false in
+  let _ = visitCilStmt (object
+      inherit nopCilVisitor
+      method vstmt s =
+        if s.labels <> [] then labeled := true ;
+        DoChildren
+    end) s
+  in
+  {
+    shape_key = Digest.string pretty_printed ;
+    shape_empty = stmt_is_empty s ;
+    shape_falls_through = stmt_falls_through s ;
+    shape_labeled = !labeled ;
+  }
+
 (** {8 Initial source code processing} *)
 
 (**/**)
@@ -494,17 +565,19 @@ class infoVisitor (filename : string) (write_info : int -> stmt_info -> unit) =
 (** This visitor walks over the C program AST, collecting in scope variables.
     This visitor must start from the top of the AST. Otherwise, it may miss
     the declarations for in-scope variables and fail to include them in the
-    results.
+    results, unless those declarations are supplied in [globals].
 
+    @param globals    IDs of the global variables already in scope
     @param read_info  function to get any existing info for a statement
     @param write_info function to set info for a statement *)
 class scopeVisitor
+    ?(globals = IntSet.empty)
     (read_info : int -> stmt_info)
     (write_info : int -> stmt_info -> unit) =
   object
     inherit nopCilVisitor
 
-    val mutable globals_seen = IntSet.empty
+    val mutable globals_seen = globals
     val mutable locals_seen  = IntSet.empty
     val mutable current_fun  = dummyFunDec
 
@@ -1166,6 +1239,9 @@ class fixPutVisitor = object
     end else DoChildren
 end
 
+(** This visitor replaces the [subatom_id]th expression of statement [atom_id],
+    counting as [getExpVisitor] does, with [atom]. It stops descending as soon
+    as the replacement has been made. *)
 class replaceSubatomVisitor atom_id subatom_id atom =
   object
     inherit nopCilVisitor
@@ -1175,9 +1251,12 @@ class replaceSubatomVisitor atom_id subatom_id atom =
     val this_subatom = ref (-1)
 
     method vstmt s =
-      let parent_sid = this_sid in
-      this_sid <- s.sid ;
-      ChangeDoChildrenPost(s, fun s -> this_sid <- parent_sid ; s)
+      if !this_subatom >= subatom_id then SkipChildren
+      else begin
+        let parent_sid = this_sid in
+        this_sid <- s.sid ;
+        ChangeDoChildrenPost(s, fun s -> this_sid <- parent_sid ; s)
+      end
 
     method vexpr e =
       if this_sid = atom_id then begin
@@ -1590,6 +1669,145 @@ let toposort_globals ?roots:((roots: global list) = []) (globals: global list) =
   in
   List.rev deps
 
+(** @return the name of an object file compiled from the CIL [file], or [None]
+    if it does not compile. The object is named [prefix] followed by a digest of
+    its source and of the compiler settings, so a matching object left by an
+    earlier or concurrent run is reused. *)
+let prebuilt_object prefix file =
+  let source = output_cil_file_to_string file in
+  let command name =
+    sprintf "%s -c -o %s.o %s.i %s 2>/dev/null >/dev/null"
+      !compiler_name name name !compiler_options
+  in
+  (* the compiler settings are part of the key, so that changing them does not
+     pick up a stale object *)
+  let key = String.concat "\n" [command ""; !compiler_command; source] in
+  let base =
+    Filename.concat (Unix.getcwd ())
+      (prefix ^ (Digest.to_hex (Digest.string key)))
+  in
+  let obj = base ^ ".o" in
+  if Sys.file_exists obj then Some(obj)
+  else begin
+    let tmp = sprintf "%s.%d" base (Unix.getpid ()) in
+    let fout = open_out (tmp ^ ".i") in
+    output_string fout source ;
+    close_out fout ;
+    let cmd = command tmp in
+    let built =
+      match system cmd with
+      | Unix.WEXITED(0) -> Unix.rename (tmp ^ ".o") obj ; true
+      | _ -> false
+    in
+    (try Unix.unlink (tmp ^ ".i") with _ -> ()) ;
+    if built then Some(obj) else None
+  end
+
+(** With [--fault-scope], the objects compiled from the files dropped from the
+    code bank; every variant is linked against them. *)
+let scope_objects = ref []
+
+(** {8 Call graph} With [--reachable-from], fault atoms in functions that the
+    given entry points can never call are dropped before the search. *)
+
+(** the fault atoms dropped by [--reachable-from]. They are no longer edit
+    destinations, but a reachable atom may still be swapped with them. *)
+let swap_partners = ref []
+
+(** records, for each function (by name), the functions it calls by name, the
+    function expressions of its indirect calls, and the arguments of each
+    call by name. Functions whose addresses are taken anywhere (including
+    global initializers) are added to [taken]; constructors and destructors
+    to [roots]. *)
+class callGraphVisitor direct indirect args taken roots = object
+  inherit nopCilVisitor
+
+  val current = ref ""
+
+  method vfunc fd =
+    current := fd.svar.vname ;
+    if hasAttribute "constructor" fd.svar.vattr
+    || hasAttribute "destructor" fd.svar.vattr then
+      roots := fd.svar.vname :: !roots ;
+    ChangeDoChildrenPost(fd, fun fd -> current := "" ; fd)
+
+  method vinst i =
+    (match i with
+     | Call(_, Lval(Var(v),NoOffset), actuals, _) ->
+       Hashtbl.add direct !current v.vname ;
+       Hashtbl.add args !current (v.vname, actuals)
+     | Call(_, fexp, _, _) -> Hashtbl.add indirect !current fexp
+     | _ -> ()) ;
+    DoChildren
+
+  method vexpr e =
+    (match e with
+     | AddrOf(Var(v),NoOffset) when isFunctionType v.vtype ->
+       taken := StringSet.add v.vname !taken
+     | _ -> ()) ;
+    DoChildren
+end
+
+(** @return the names of the functions [entries] may call, directly or not.
+    Indirect calls are resolved with [Ptranal], falling back to every function
+    whose address is taken. A function whose address is passed to a function
+    without a definition (other than the library functions [Knownfuns] knows
+    never call back) is assumed to be called, as [qsort] or [signal] would. *)
+let reachable_functions files entries =
+  let direct = Hashtbl.create 255 in
+  let indirect = Hashtbl.create 255 in
+  let args = Hashtbl.create 255 in
+  let taken = ref StringSet.empty in
+  let roots = ref entries in
+  let defined = ref StringSet.empty in
+  StringMap.iter (fun _ file ->
+      iterGlobals file (function
+          | GFun(fd,_) -> defined := StringSet.add fd.svar.vname !defined
+          | _ -> ()) ;
+      visitCilFileSameGlobals
+        (new callGraphVisitor direct indirect args taken roots) file
+    ) files ;
+  Progeq.compute_aliases files ;
+  let calls_back name =
+    not (StringSet.mem name !defined) &&
+    (name = "atexit" || name = "at_quick_exit" ||
+     not (Knownfuns.is_pure_function name || Knownfuns.is_io_function name))
+  in
+  let functions_in e =
+    let found = ref StringSet.empty in
+    let _ = visitCilExpr (new callGraphVisitor (Hashtbl.create 1)
+                           (Hashtbl.create 1) (Hashtbl.create 1) found (ref []))
+        e
+    in
+    let pointed =
+      try
+        lfilt (fun v -> isFunctionType v.vtype) (Ptranal.resolve_exp e)
+      with Ptranal.UnknownLocation | Not_found -> []
+    in
+    lfoldl (fun found v -> StringSet.add v.vname found) !found pointed
+  in
+  let reachable = ref StringSet.empty in
+  let rec visit name =
+    if not (StringSet.mem name !reachable) then begin
+      reachable := StringSet.add name !reachable ;
+      liter visit (Hashtbl.find_all direct name) ;
+      liter (fun fexp ->
+          match
+            (try Ptranal.resolve_funptr fexp
+             with Ptranal.UnknownLocation | Not_found -> [])
+          with
+          | [] -> StringSet.iter visit !taken
+          | fds -> liter (fun fd -> visit fd.svar.vname) fds
+        ) (Hashtbl.find_all indirect name) ;
+      liter (fun (callee, actuals) ->
+          if calls_back callee then
+            liter (fun e -> StringSet.iter visit (functions_in e)) actuals
+        ) (Hashtbl.find_all args name)
+    end
+  in
+  liter visit !roots ;
+  !reachable
+
 (** {8 CIL Representation implementations } The virtual superclass implements
     much of the source code processing.  The only conceptual difference between
     the [patchCilRep] and [astCilRep] is the type of the underlying gene.
@@ -1625,6 +1843,44 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
   (** Maps variable IDs to the corresponding fundec object *)
   val mutable fix_funmap : fundec IntMap.t ref = ref IntMap.empty
 
+  (** Caches the subatoms (expressions) of code bank statements, indexed by
+      subatom id. Code bank statements never change, so this is computed at
+      most once per statement and shared between all copies. *)
+  val subatom_cache : (int, exp array) Hashtbl.t = Hashtbl.create 257
+
+  (** Index used to solve template hole constraints: the variables and
+      printed type of each code bank subatom, the printed type of each
+      variable, and the variables grouped by name (together with the varmap
+      it was built from). Like [subatom_cache], it is filled in on demand and
+      shared between all copies. *)
+  val template_exp_vars : (int * int, IntSet.t) Hashtbl.t = Hashtbl.create 257
+  val template_exp_types : (int * int, string) Hashtbl.t = Hashtbl.create 257
+  val template_var_types : (int, string) Hashtbl.t = Hashtbl.create 257
+  val template_var_names : (varinfo IntMap.t * IntSet.t StringMap.t) ref =
+    ref (IntMap.empty, StringMap.empty)
+
+  (** The [stmt_shape] of each code bank statement, filled in on demand for
+      --ignore-noop-edits and shared between all copies. *)
+  val stmt_shapes : (int, stmt_shape) Hashtbl.t = Hashtbl.create 257
+
+  (** The append, swap and replace sources at each fault atom, together with
+      the statement info and candidate list they were computed from. An edit
+      (including a nested one) only replaces the info of the statements it
+      changes, so an entry stays valid while both are physically unchanged.
+      The swap sources also depend on the info of the other fault atoms; this
+      relies on every edit that can change that info also building a new
+      fault localization list (see [update_localization] in [patchCilRep]).
+      Shared between all copies; see [indexed_sources]. *)
+  val source_index :
+    (mutation_id * atom_id, stmt_info * (atom_id * float) list * WeightSet.t)
+      Hashtbl.t = Hashtbl.create 257
+
+  (** Whether two fault atoms can be swapped, together with the statement
+      info of each that the answer was computed from. Only used with
+      --do-nested, where the fault localization changes with every edit. *)
+  val swap_index : (atom_id * atom_id, stmt_info * stmt_info * bool) Hashtbl.t =
+    Hashtbl.create 257
+
   method copy () : 'self_type =
     let super_copy : 'self_type = super#copy () in
     (* Don't create a copy of stmt_count, stmt_data, or varmap. They should
@@ -1670,6 +1926,7 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
       Marshal.to_channel fout (!global_ast_info.code_bank) [] ;
       Marshal.to_channel fout (!global_ast_info.oracle_code) [] ;
       Marshal.to_channel fout (!global_ast_info.fault_localization) [] ;
+      Marshal.to_channel fout (!scope_objects) [] ;
     end;
     Marshal.to_channel fout (self#get_genome()) [] ;
     debug "cilRep: %s: saved\n" filename ;
@@ -1700,6 +1957,7 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
       let code_bank = Marshal.from_channel fin in
       let oracle_code = Marshal.from_channel fin in
       let localization = Marshal.from_channel fin in
+      scope_objects := Marshal.from_channel fin ;
       global_ast_info :=
         { code_bank = code_bank;
           oracle_code = oracle_code;
@@ -1726,6 +1984,81 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
   method private get_fault_space_info sid =
     hfind stmt_data sid
 
+  method private get_stmt_shape sid =
+    ht_find stmt_shapes sid (fun () -> stmt_shape (snd (self#get_stmt sid)))
+
+  (* --ignore-noop-edits judges statements in the fault space by their code
+   * bank shape, which nested mutation may have changed. *)
+  method private fault_shapes_valid () =
+    !ignore_noop_edits && not !do_nested
+
+  method reduce_search_space split_fun do_uniq =
+    if !reachable_from <> "" then self#internal_prune_unreachable () ;
+    super#reduce_search_space split_fun do_uniq
+
+  (** with --reachable-from, drops the fault atoms in functions the entry
+      points cannot call (see [reachable_functions]), then the fix atoms that
+      are in scope at none of the remaining fault atoms. The edits this rules
+      out could never be executed or could never be made. The dropped fault
+      atoms are kept in [swap_partners]: swapping one with a reachable atom
+      still changes reachable code. *)
+  method private internal_prune_unreachable () =
+    let entries = Str.split comma_regexp !reachable_from in
+    let files = !global_ast_info.code_bank in
+    let defined name =
+      StringMap.exists (fun _ file ->
+          List.exists (function
+              | GFun(fd,_) -> fd.svar.vname = name
+              | _ -> false) file.globals
+        ) files
+    in
+    if !scope_objects <> [] then
+      debug "cilRep: --reachable-from: ignored with --fault-scope\n"
+    else if not (List.exists defined entries) then
+      debug "cilRep: --reachable-from: no entry point %s is defined\n"
+        !reachable_from
+    else begin
+      let reachable =
+        Stats2.time "call graph" (reachable_functions files) entries in
+      let in_reachable (atom,_) =
+        try
+          let fd = IntMap.find (hfind stmt_data atom).in_func !fix_funmap in
+          StringSet.mem fd.svar.vname reachable
+        with Not_found -> true
+      in
+      let faults = lfilt in_reachable !fault_localization in
+      if faults = [] then
+        debug "cilRep: --reachable-from: no fault atom is reachable\n"
+      else begin
+        let scopes =
+          lmap (fun (atom,_) ->
+              let info = hfind stmt_data atom in
+              semantic_equiv_vars !varmap
+                (IntSet.union info.local_ids info.global_ids)
+            ) faults
+        in
+        let insertable (atom,_) =
+          try
+            let used = (hfind stmt_data atom).usedvars in
+            List.exists (fun equivalents ->
+                IntSet.for_all (fun n -> equivalents n <> []) used
+              ) scopes
+          with Not_found -> true
+        in
+        let fixes = lfilt insertable !fix_localization in
+        debug "cilRep: --reachable-from: %d functions reachable; fault atoms %d -> %d, fix atoms %d -> %d\n"
+          (StringSet.cardinal reachable)
+          (llen !fault_localization) (llen faults)
+          (llen !fix_localization) (llen fixes) ;
+        swap_partners :=
+          lfilt (fun atom -> not (in_reachable atom)) !fault_localization ;
+        fault_localization := faults ;
+        fix_localization := fixes ;
+        global_ast_info :=
+          {!global_ast_info with fault_localization = faults}
+      end
+    end
+
   (* Use an approximation to the program equivalence relation to
    * remove duplicate edits (i.e., those that would yield semantically
    * equivalent programs) from consideration. Command line arguments
@@ -2113,6 +2446,24 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
       debug "cilRep: computed liveness\n" ;
     end
 
+  (** as [internal_collect_stmt_info], but only visits a single global (usually
+      a function definition). [globals] is the set of global variable IDs in
+      scope at that global. *)
+  method private internal_collect_global_stmt_info
+      (globals : IntSet.t)
+      (g : Cil.global)
+      (reader : int -> stmt_info)
+      (writer : int -> stmt_info -> unit) : unit =
+    ignore (visitCilGlobal (new scopeVisitor ~globals reader writer) g);
+    ignore (visitCilGlobal (new syntaxScopeVisitor reader writer) g);
+    ignore (visitCilGlobal (new labelVisitor reader writer) g);
+
+    if !ignore_dead_code then begin
+      let copy_g = copy g in
+      ignore (visitCilGlobal my_sid_to_label copy_g) ;
+      ignore (visitCilGlobal (my_liveness reader writer) copy_g)
+    end
+
   (** parses and then processes one C file.  Collects all necessary data for
       semantic checking and updates the global ast information in
       [global_ast_info].
@@ -2162,9 +2513,70 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
 
   method compute_localization () =
     super#compute_localization ();
+    if !fault_scope then self#internal_scope_to_faults () ;
     global_ast_info := {!global_ast_info with
                         fault_localization = !fault_localization}
 
+  (** drops the files that hold no fault or fix atom, and are not named by
+      [--fault-scope-files], from the code bank. Each is compiled once into an
+      object that every variant links against, so variants copy, print and
+      compile only the remaining files. The dropped files' variables stay in
+      [varmap] for scope and type checks. *)
+  method private internal_scope_to_faults () =
+    let info = !global_ast_info in
+    let named = Str.split comma_regexp !fault_scope_files in
+    let atom_files =
+      lfoldl (fun files (atom,_) ->
+          try StringSet.add (hfind stmt_data atom).in_file files
+          with Not_found -> files
+        ) StringSet.empty (!fault_localization @ !fix_localization)
+    in
+    let editable fname _ =
+      StringSet.mem fname atom_files ||
+      List.exists (fun n ->
+          n = fname || n = Filename.basename fname) named
+    in
+    let kept, dropped = StringMap.partition editable info.code_bank in
+    if not (StringMap.is_empty kept || StringMap.is_empty dropped) then begin
+      let objects =
+        StringMap.fold (fun fname file objects ->
+            match prebuilt_object "scope-" file with
+            | Some(obj) -> obj :: objects
+            | None -> abort "cilRep: --fault-scope: cannot compile %s\n" fname
+          ) dropped []
+      in
+      let dropped_sids =
+        Hashtbl.fold (fun sid info sids ->
+            if StringMap.mem info.in_file dropped then sid :: sids else sids
+          ) stmt_data []
+      in
+      liter (Hashtbl.remove stmt_data) dropped_sids ;
+      let dropped_funs, dropped_locals =
+        StringMap.fold (fun _ file acc ->
+            foldGlobals file (fun (funs, locals) g ->
+                match g with
+                | GFun(fd,_) ->
+                  IntSet.add fd.svar.vid funs,
+                  lfoldl (fun locals va -> IntSet.add va.vid locals)
+                    locals (fd.sformals @ fd.slocals)
+                | _ -> funs, locals
+              ) acc
+          ) dropped (IntSet.empty, IntSet.empty)
+      in
+      fix_funmap :=
+        IntMap.filter (fun vid _ -> not (IntSet.mem vid dropped_funs))
+          !fix_funmap ;
+      varmap :=
+        IntMap.filter (fun vid _ -> not (IntSet.mem vid dropped_locals))
+          !varmap ;
+      scope_objects := !scope_objects @ objects ;
+      global_ast_info := {info with code_bank = kept} ;
+      debug "cilRep: --fault-scope: %d of %d files editable, %d atoms dropped\n"
+        (StringMap.cardinal kept)
+        (StringMap.cardinal kept + StringMap.cardinal dropped)
+        (llen dropped_sids)
+    end
+
   (**/**)
   method internal_post_source filename = ()
 
@@ -2179,7 +2591,8 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
           ) (self#get_current_files ()) ""
       end else source_name
     in
-    super#compile source_name exe_name;
+    self#internal_compile source_name
+      (String.concat " " (source_name :: !scope_objects)) exe_name
 
   method updated () =
     (*    already_signatured := None;*)
@@ -2352,9 +2765,38 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
         check_available_vars !varmap (IntSet.singleton va.vid) liveness
       | _ -> true)
 
+  (* --ignore-noop-edits: deleting a statement that does nothing changes
+   * nothing *)
+  method can_delete stmt_id =
+    not (self#fault_shapes_valid () &&
+         (self#get_stmt_shape stmt_id).shape_empty)
+
+  (** returns the [mut] sources at [atom], recomputing them only if the
+      statement info at [atom] or the list of [candidates] changed since they
+      were last computed. *)
+  method private indexed_sources mut atom candidates compute =
+    let info = self#get_fault_space_info atom in
+    let cached =
+      try
+        let info', candidates', sources = hfind source_index (mut, atom) in
+        if info' == info && candidates' == candidates then Some(sources)
+        else None
+      with Not_found -> None
+    in
+    match cached with
+    | Some(sources) -> sources
+    | None ->
+      let sources = compute () in
+      hrep source_index (mut, atom) (info, candidates, sources) ;
+      sources
+
   (* Return a Set of (atom_ids,fix_weight pairs) that one could append here
    * without violating many typing rules. *)
   method append_sources append_after =
+    self#indexed_sources Append_mut append_after !fix_localization
+      (fun () -> self#internal_append_sources append_after)
+
+  method private internal_append_sources append_after =
     let dst = self#get_fault_space_info append_after in
     let all_sids =
       match dst.unique_appends with
@@ -2371,6 +2813,20 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
       lfilt (fun (sid,weight) ->
           self#can_insert append_after sid) sids
     in
+    (* --ignore-noop-edits: appending nothing changes nothing, and neither
+     * does appending after "return;" unless a label makes it reachable *)
+    let sids =
+      if !ignore_noop_edits then begin
+        let dead_after =
+          self#fault_shapes_valid () &&
+          not (self#get_stmt_shape append_after).shape_falls_through
+        in
+        lfilt (fun (sid, _) ->
+            let src = self#get_stmt_shape sid in
+            not (src.shape_empty || (dead_after && not src.shape_labeled))
+          ) sids
+      end else sids
+    in
     lfoldl
       (fun retval ele -> WeightSet.add ele retval)
       (WeightSet.empty) sids
@@ -2379,21 +2835,62 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
    * typing rules. In addition, if X<Y and X and Y are both valid, then we'll
    * allow the swap (X,Y) but not (Y,X).  *)
   method swap_sources append_after =
+    self#indexed_sources Swap_mut append_after !fault_localization
+      (fun () -> self#internal_swap_sources append_after)
+
+  (* With --do-nested, the pairwise checks are cached in [swap_index], so only
+   * the pairs involving a statement whose info an edit changed are redone. *)
+  method private can_swap here there =
+    let compute () =
+      let here_info = self#get_fault_space_info here in
+      let there_info = self#get_fault_space_info there in
+      in_scope_at !varmap here_info there_info &&
+      in_scope_at !varmap there_info here_info &&
+      self#can_insert ~before:true ~fault_src:true there here &&
+      self#can_insert ~before:true ~fault_src:true here there
+    in
+    if not !do_nested then compute ()
+    else begin
+      let key = min here there, max here there in
+      let info1 = self#get_fault_space_info (fst key) in
+      let info2 = self#get_fault_space_info (snd key) in
+      let cached =
+        try
+          let info1', info2', ok = hfind swap_index key in
+          if info1' == info1 && info2' == info2 then Some(ok) else None
+        with Not_found -> None
+      in
+      match cached with
+      | Some(ok) -> ok
+      | None ->
+        let ok = compute () in
+        hrep swap_index key (info1, info2, ok) ;
+        ok
+    end
+
+  method private internal_swap_sources append_after =
     (* FIXME: should we prevent swapping an if-statement with one of its
        branches? *)
-    let all_sids = !fault_localization in
+    let partners =
+      if not !do_nested then !swap_partners
+      else
+        (* an earlier edit may have moved a partner out of this variant *)
+        match atoms_visited_by_edit_history (self#get_history ()) with
+        | visited ->
+          lfilt (fun (sid,_) -> not (AtomSet.mem sid visited)) !swap_partners
+        | exception Failure _ -> []
+    in
+    let all_sids = !fault_localization @ partners in
+    let sids = lfilt (fun (sid, weight) -> sid <> append_after) all_sids in
+    let sids = lfilt (fun (sid, _) -> self#can_swap append_after sid) sids in
+    (* --ignore-noop-edits: swapping identical statements changes nothing *)
     let sids =
-      let here = self#get_fault_space_info append_after in
-      lfilt (fun (sid, _) ->
-          let there = self#get_fault_space_info sid in
-          in_scope_at !varmap here there && in_scope_at !varmap there here
-        ) all_sids
+      if self#fault_shapes_valid () then begin
+        let here = (self#get_stmt_shape append_after).shape_key in
+        lfilt (fun (sid, _) ->
+            (self#get_stmt_shape sid).shape_key <> here) sids
+      end else sids
     in
-    let sids = lfilt (fun (sid, weight) -> sid <> append_after) sids in
-    let sids = lfilt (fun (sid, weight) ->
-        self#can_insert ~before:true ~fault_src:true sid append_after &&
-        self#can_insert ~before:true ~fault_src:true append_after sid
-      ) sids in
     lfoldl (fun retval ele -> WeightSet.add ele retval)
       (WeightSet.empty) sids
 
@@ -2401,6 +2898,10 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
    * typing rules. In addition, if X<Y and X and Y are both valid, then we'll
    * allow the swap (X,Y) but not (Y,X).  *)
   method replace_sources replace =
+    self#indexed_sources Replace_mut replace !fix_localization
+      (fun () -> self#internal_replace_sources replace)
+
+  method private internal_replace_sources replace =
     let all_sids = !fix_localization in
     let sids =
       let dst = self#get_fault_space_info replace in
@@ -2410,6 +2911,22 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
     in
     let sids = lfilt (fun (sid, weight) -> sid <> replace) sids in
     let sids = lfilt (fun (sid, weight) -> self#can_insert ~before:true replace sid) sids in
+    (* --ignore-noop-edits: replacing a statement with a copy of itself
+     * changes nothing, and replacing it with nothing is a delete *)
+    let sids =
+      if !ignore_noop_edits then begin
+        let here =
+          if self#fault_shapes_valid () then
+            Some((self#get_stmt_shape replace).shape_key)
+          else None
+        in
+        let deletes = List.mem_assoc Delete_mut !mutations in
+        lfilt (fun (sid, _) ->
+            let src = self#get_stmt_shape sid in
+            not ((deletes && src.shape_empty) || Some(src.shape_key) = here)
+          ) sids
+      end else sids
+    in
 
     lfoldl (fun retval ele -> WeightSet.add ele retval)
       (WeightSet.empty) sids
@@ -2423,19 +2940,49 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
 
   method subatoms = true
 
-  method get_subatoms ~fault_src stmt_id =
-    let stmt =
-      if fault_src then self#get stmt_id else snd (self#get_stmt stmt_id)
-    in
+  (** @return the expressions of a statement, numbered in the same order that
+      [replaceSubatomVisitor] counts them *)
+  method private enumerate_subatoms stmt =
     let output = ref [] in
     let _ = visitCilStmt (my_get_exp output) stmt in
-    List.map (fun x -> Exp x) !output
+    Array.of_list !output
+
+  (** the subatoms of a statement in this variant are the same as in the code
+      bank unless an edit in this variant's history targets the statement
+      itself (subatoms do not include the expressions of nested statements).
+      Only edited statements are looked up and enumerated again. *)
+  (* whether every change to this variant's code is recorded in its history,
+   * so that the statements the history does not visit are known to match the
+   * code bank. Not so for astCilRep, whose set_genome puts statements
+   * directly. *)
+  method private history_records_edits () = false
+
+  method private subatom_array ~fault_src stmt_id =
+    let edited =
+      fault_src &&
+      (not (self#history_records_edits ()) ||
+       (try
+          AtomSet.mem stmt_id
+            (atoms_visited_by_edit_history (self#get_history ()))
+        with Failure _ -> true))
+    in
+    if edited || not (hmem stmt_data stmt_id) then
+      let stmt =
+        if fault_src then self#get stmt_id else snd (self#get_stmt stmt_id)
+      in
+      self#enumerate_subatoms stmt
+    else
+      ht_find subatom_cache stmt_id (fun () ->
+          self#enumerate_subatoms (snd (self#get_stmt stmt_id)))
+
+  method get_subatoms ~fault_src stmt_id =
+    Array.to_list
+      (Array.map (fun x -> Exp x) (self#subatom_array ~fault_src stmt_id))
 
   method get_subatom ~fault_src stmt_id atom_id =
     if fault_src then
       abort "You really have to call get_subatom with fault_src being false\n";
-    let subatoms = self#get_subatoms ~fault_src stmt_id in
-    List.nth subatoms  atom_id
+    Exp (self#subatom_array ~fault_src stmt_id).(atom_id)
 
   method replace_subatom_with_constant stmt_id subatom_id =
     self#replace_subatom stmt_id subatom_id (Exp Cil.zero)
@@ -2492,32 +3039,6 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
     let fix_stmts () =  iset_of_lst (lmap fst (self#get_fix_source_atoms())) in
 
     (* utilities *)
-    let expr_in_scope position e =
-      let pos_info = self#get_fault_space_info position in
-      let all_vars = IntSet.union pos_info.local_ids pos_info.global_ids in
-      let rec internal_match = function
-        | Const _ | SizeOf _ | SizeOfStr _ | AlignOf _ -> true
-        | AlignOfE(e) | UnOp(_,e,_) | CastE(_,e) | SizeOfE(e) -> internal_match e
-        | BinOp(_,e1,e2,_) -> (internal_match e1) && (internal_match e2)
-        | Question(e1,e2,e3,_) ->
-          (internal_match e1) && (internal_match e2) && (internal_match e3)
-        | Lval(h,o) | AddrOf(h,o) | StartOf(h,o) ->
-          begin
-            let host = function
-              | Var(v) -> IntSet.mem v.vid all_vars
-              | Mem(e) -> internal_match e
-            in
-            let rec offset = function
-              | NoOffset -> true
-              | Field(_,o) -> offset o
-              | Index(e,o) -> (internal_match e) && (offset o)
-            in
-            (host h) && (offset o)
-          end
-        | _ -> true (* truly obscure C structures; if you want them, you can deal with them *)
-      in
-      internal_match e
-    in
     let rec get_exp_vars = function
       | Const _ | SizeOf _ | SizeOfStr _ | AlignOf _ -> IntSet.empty
       | SizeOfE(e) | AlignOfE(e) | UnOp(_,e,_) | CastE(_,e)  -> get_exp_vars e
@@ -2539,12 +3060,62 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
         (IntSet.union (host h) (offset o))
       | _ -> IntSet.empty (* truly obscure C structures; if you want them, you can deal with them *)
     in
+    let type_name typ =
+      Pretty.sprint ~width:80 (printType defaultCilPrinter () typ)
+    in
+    (* facts about a code bank subatom are looked up in the template index,
+       and computed at most once for statements whose subatoms are cached *)
+    let subatom_fact table (stmt_id,subatom_id) compute =
+      let get_exp () =
+        get_exp_from_subatom
+          (self#get_subatom ~fault_src:false stmt_id subatom_id)
+      in
+      if hmem stmt_data stmt_id then
+        ht_find table (stmt_id,subatom_id) (fun _ -> compute (get_exp ()))
+      else compute (get_exp ())
+    in
+    let exp_vars pair = subatom_fact template_exp_vars pair get_exp_vars in
+    let exp_type pair =
+      subatom_fact template_exp_types pair
+        (fun e -> type_name (Cil.typeOf (Cil.stripCasts e)))
+    in
+    let var_type vid =
+      ht_find template_var_types vid
+        (fun _ -> type_name (IntMap.find vid !varmap).vtype)
+    in
+    let vars_named name =
+      if fst !template_var_names != !varmap then begin
+        let by_name =
+          IntMap.fold (fun vid varinfo by_name ->
+              let same_name =
+                try StringMap.find varinfo.vname by_name
+                with Not_found -> IntSet.empty
+              in
+              StringMap.add varinfo.vname (IntSet.add vid same_name) by_name)
+            !varmap StringMap.empty
+        in
+        template_var_names := (!varmap, by_name)
+      end;
+      try StringMap.find name (snd !template_var_names)
+      with Not_found -> IntSet.empty
+    in
+    (* an expression is in scope at the instantiation position if every
+       variable it mentions is; the variables in scope are computed once *)
+    let scope_vars =
+      lazy (let pos_info = self#get_fault_space_info position in
+            IntSet.union pos_info.local_ids pos_info.global_ids)
+    in
+    let expr_in_scope pair =
+      IntSet.subset (exp_vars pair) (Lazy.force scope_vars)
+    in
     let get_exp_refs other_hole assignment =
       let ht,sid,sb = StringMap.find other_hole assignment in
       match ht with
         HStmt ->
         (* possible fixme: the assumption that fault_src is false here is not necessarily accurate, but it really shouldn't matter in practice *)
-        let subatoms = 0 -- ((llen (self#get_subatoms ~fault_src:false sid)) - 1) in
+        let num_subatoms =
+          Array.length (self#subatom_array ~fault_src:false sid) in
+        let subatoms = 0 -- (num_subatoms - 1) in
         let candidates = List.fold_left (fun pairset subatom_id ->
             PairSet.add (sid,subatom_id) pairset) PairSet.empty subatoms
         in
@@ -2565,26 +3136,12 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
            | HasType(name) ->
              (* fixme: see my note on hasType for lvals for the fragility of this
                 constraint, which must be tested *)
-             PairSet.filter
-               (fun (stmt_id,subatom_id) ->
-                  let all_subatoms = self#get_subatoms ~fault_src:false stmt_id in
-                  let candidate_exp = get_exp_from_subatom (List.nth all_subatoms subatom_id) in
-                  let candidate_exp = Cil.stripCasts candidate_exp in
-                  let candidate_typ = Cil.typeOf candidate_exp in
-                  let typ_as_str = Pretty.sprint ~width:80 (printType defaultCilPrinter () candidate_typ) in
-                  (* fixme: check this comparison *)
-                  typ_as_str = name)
-               current
+             (* fixme: check this comparison *)
+             PairSet.filter (fun pair -> exp_type pair = name) current
            | HasVar(name) ->
+             let named = vars_named name in
              PairSet.filter
-               (fun (stmt_id,subatom_id) ->
-                  let all_subatoms = self#get_subatoms ~fault_src:false stmt_id in
-                  let candidate_exp = get_exp_from_subatom (List.nth all_subatoms subatom_id) in
-                  let candidate_vars = get_exp_vars candidate_exp in
-                  IntSet.exists (fun vid ->
-                      let varinfo = IntMap.find vid !varmap in
-                      (* fixme: check this string comparison *)
-                      varinfo.vname = name) candidate_vars)
+               (fun pair -> not (IntSet.is_empty (IntSet.inter named (exp_vars pair))))
                current
            | _ ->
              (* IsLocal IsGlobal *)
@@ -2614,10 +3171,7 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
                     question andwe can only do that by getting all subatoms
                     from the enclosing statement.  Again, the way we handle
                     expressions is unsustainable...*)
-                 let all_subatoms = self#get_subatoms ~fault_src:false sid in
-                 let this_id = get_opt sb in
-                 let this_exp = get_exp_from_subatom (List.nth all_subatoms this_id) in
-                 let this_exps_vars = get_exp_vars this_exp in
+                 let this_exps_vars = exp_vars (sid, get_opt sb) in
                  IntSet.inter current this_exps_vars
                | HLval -> IntSet.inter (IntSet.singleton sid) current
              end
@@ -2628,20 +3182,8 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
                 construct a more complicated constraint that refers to the actual
                 type of an actual declared variable in the template, but that's
                 complicated so let's see how broken this cheap approach is first. *)
-             IntSet.filter
-               (fun candidate_vid ->
-                  let varinfo = IntMap.find candidate_vid !varmap in
-                  let typ_as_str = Pretty.sprint ~width:80 (printType defaultCilPrinter () varinfo.vtype) in
-                  (* again, fixme: check the rules for string comparison to make sure this isn't broken.*)
-                  typ_as_str = str
-               ) current
-           | HasVar(str)  ->
-             IntSet.filter
-               (fun candidate_vid ->
-                  let varinfo = IntMap.find candidate_vid !varmap in
-                  (* again, fixme: check the rules for string comparison to make sure this isn't broken.*)
-                  varinfo.vname = str
-               ) current
+             IntSet.filter (fun candidate_vid -> var_type candidate_vid = str) current
+           | HasVar(str)  -> IntSet.inter (vars_named str) current
            | IsLocal ->
              let stmt_info = self#get_fault_space_info position in
              IntSet.inter stmt_info.local_ids current
@@ -2656,17 +3198,14 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
         (fun current constrnt ->
            match constrnt with
            | HasVar(v) ->
+             let named = vars_named v in
              IntSet.filter
                (fun stmt_id ->
                   let stmt_info = self#get_fix_space_info stmt_id in
-                  (* this "exists" checks if there's a variable used by the
-                     statement we're considering that has the name specified in
-                     the HasVar constraint *)
-                  IntSet.exists (fun vid -> let vinfo = IntMap.find vid !varmap in
-                                  (* possible FIXME: I never remember
-                                     if string compare should be
-                                     single or double equal *)
-                                  vinfo.vname = v) (stmt_info.usedvars)
+                  (* checks if there's a variable used by the statement we're
+                     considering that has the name specified in the HasVar
+                     constraint *)
+                  not (IntSet.is_empty (IntSet.inter named stmt_info.usedvars))
                ) current
            | _ ->
              (* Ref, HasType, IsLocal, IsGlobal *)
@@ -2697,25 +3236,17 @@ class virtual ['gene] cilRep  = object (self : 'self_type)
               let exprs,constraints = single_constraint rest in
               exprs, first::constraints
             | [] -> (* either the expression is unconstrained, or we didn't find a ref, so we just enforce that the candidate expressions must be in scope *)
-              let get_numbered_subatoms stmt =
-                (* this bit of silliness is so that the double-fold below can be
-                   tail-recursive.  The list ends up reversed, but it doesn't
-                   matter (because of the numbering ). *)
-                fst
-                  (lfoldl (fun (lst,count) e ->
-                       let e = get_exp_from_subatom e in
-                       (e,count) :: lst, count + 1)
-                      ([],0) (self#get_subatoms ~fault_src:false stmt))
-              in
               IntSet.fold
                 (fun stmt all_set ->
+                   let num_subatoms =
+                     Array.length (self#subatom_array ~fault_src:false stmt) in
                    List.fold_left
-                     (fun set (e,count) ->
-                        if expr_in_scope position e then
+                     (fun set count ->
+                        if expr_in_scope (stmt,count) then
                           PairSet.add (stmt,count) set
                         else
                           set
-                     ) all_set (get_numbered_subatoms stmt))
+                     ) all_set (0 -- (num_subatoms - 1)))
                 (fix_stmts()) (PairSet.empty), []
           in
           let startset,constraints' = single_constraint (ConstraintSet.elements hole.constraints) in
@@ -2818,6 +3349,86 @@ end
 
 let patchCilRep_fileCache = ref None
 
+(** {8 Split compilation} With [--split-compile], a single-file C program is
+    compiled once into a shared object in which every function is weak and
+    nothing is static: statics are given external names that are unique to
+    the file (see [unstatic]). Each variant is then compiled as a small unit holding
+    only the functions its edits touch, with declarations for everything else,
+    and linked against that object; the unit's definitions override the weak
+    ones. *)
+
+(** [None] until the shared object has been tried, then the name of the
+    object or [None] if it could not be built *)
+let split_base = ref None
+
+(** the prefix given to the names of the statics of [file]; it is derived
+    from the file name, so the shared object and every variant unit agree *)
+let static_prefix file =
+  sprintf "__genprog_%s_"
+    (String.sub (Digest.to_hex (Digest.string file.fileName)) 0 12)
+
+(** makes [vi] external and not inline. A static is renamed with [prefix] so
+    that it cannot interpose on, or collide with, a symbol of the same name in
+    another object or library. Globals may be visited more than once (e.g., a
+    prototype and a definition share a varinfo), but are only renamed once,
+    since they are no longer static afterwards. *)
+let unstatic prefix vi =
+  if vi.vstorage = Static then begin
+    vi.vstorage <- NoStorage ;
+    vi.vname <- prefix ^ vi.vname
+  end ;
+  vi.vinline <- false
+
+(** @return a copy of [file] in which every function is weak and no global
+    is static or inline *)
+let split_base_file file =
+  let prefix = static_prefix file in
+  let file = copy file in
+  iterGlobals file (function
+      | GFun(fd,_) ->
+        unstatic prefix fd.svar ;
+        fd.svar.vattr <- addAttribute (Attr("weak",[])) fd.svar.vattr
+      | GVar(vi,_,_) | GVarDecl(vi,_) -> unstatic prefix vi
+      | _ -> ()) ;
+  file
+
+(** @return a copy of [file] that defines only the functions in [edited] and
+    declares every other function and variable *)
+let split_variant_file file edited =
+  let prefix = static_prefix file in
+  let file = copy file in
+  let globals =
+    lfoldl (fun globals g ->
+        match g with
+        | GFun(fd,_) when IntSet.mem fd.svar.vid edited -> g :: globals
+        | GFun(fd,l) -> GVarDecl(fd.svar,l) :: globals
+        | GVar(vi,_,l) -> GVarDecl(vi,l) :: globals
+        | GAsm _ -> globals
+        | _ -> g :: globals
+      ) [] file.globals
+  in
+  liter (function
+      | GFun(fd,_) -> unstatic prefix fd.svar
+      | GVarDecl(vi,_) when isFunctionType vi.vtype -> unstatic prefix vi
+      | GVarDecl(vi,_) ->
+        unstatic prefix vi ;
+        vi.vstorage <- Extern
+      | _ -> ()
+    ) globals ;
+  { file with globals = lrev globals }
+
+(** @return the name of the shared object for the original [file], building
+    it on first use (see [prebuilt_object]) *)
+let split_base_object file =
+  match !split_base with
+  | Some(obj) -> obj
+  | None ->
+    let result = prebuilt_object "split-base-" (split_base_file file) in
+    if result = None then
+      debug "cilRep: cannot build the shared object; not splitting compilation\n" ;
+    split_base := Some(result) ;
+    result
+
 (** [patchCilRep] is the default C representation.  The individual is a list of
     edits *)
 class patchCilRep = object (self : 'self_type)
@@ -2833,21 +3444,23 @@ class patchCilRep = object (self : 'self_type)
 
   val mutable genome = ref []
 
-  val mutable stmt_overrides : (int, stmt_info) Hashtbl.t = Hashtbl.create 257
+  (* [stmt_overrides] is persistent so that copies share it structurally; each
+     edit only adds the entries for the statements whose info it changed. *)
+  val mutable stmt_overrides : stmt_info IntMap.t ref = ref IntMap.empty
 
   (**/**)
   method copy () : 'self_type =
     let super_copy : 'self_type = super#copy () in
     genome <- ref !genome;
-    stmt_overrides <- Hashtbl.copy stmt_overrides;
+    stmt_overrides <- ref !stmt_overrides;
     super_copy
 
   method private get_fault_space_info sid =
     try
       if sid = 0 then
         empty_stmt_info
-      else if hmem stmt_overrides sid then
-        hfind stmt_overrides sid
+      else if IntMap.mem sid !stmt_overrides then
+        IntMap.find sid !stmt_overrides
       else
         super#get_fault_space_info sid
     with Not_found ->
@@ -2859,52 +3472,121 @@ class patchCilRep = object (self : 'self_type)
 
   method get_genome () = !genome
 
+  (* the history is rebuilt from the genome whenever it is set *)
+  method private history_records_edits () = true
+
+  (** the atom id recorded with a gene is ignored unless nested mutation is
+      enabled, in which case fresh genes are numbered from the next unused
+      statement id. This depends on [stmt_count], so genes must be numbered in
+      the order they are applied. *)
+  method private gene_id id =
+    if not !do_nested then 0
+    else if id <> 0 then id
+    else !stmt_count + 1
+
   method private add_gene (h, id) =
-    let id =
-      if not !do_nested then 0
-      else if id <> 0 then id
-      else !stmt_count + 1
-    in
-    genome := !genome @ [(h,id)] ;
+    genome := !genome @ [(h, self#gene_id id)] ;
     self#get_current_files ()
 
-  method private regen_stmt_info files =
+  (** finds the function definitions in [files] that contain the destinations
+      of the given edits, paired with the globals in scope at each.
+
+      @return None if some edit may touch statements outside the functions
+      containing its destinations, or if a function cannot be found *)
+  method private edited_functions edits files =
+    let edit_sids h =
+      match h with
+      | Template(_,fillins) ->
+        let _,id,_ = StringMap.find "instantiation_position" fillins in [id]
+      | LaseTemplate _ -> raise Not_found
+      | _ -> AtomSet.elements (atoms_visited_by_edit_history [h])
+    in
+    try
+      let funcs =
+        lfoldl (fun funcs h ->
+            lfoldl (fun funcs sid ->
+                let info = self#get_fault_space_info sid in
+                IntMap.add info.in_func (info.in_file, info.global_ids) funcs
+              ) funcs (edit_sids h)
+          ) IntMap.empty edits
+      in
+      Some(IntMap.fold (fun vid (filename, globals) acc ->
+          let file = StringMap.find filename files in
+          let g =
+            List.find (function
+                | GFun(fd,_) -> fd.svar.vid = vid
+                | _ -> false
+              ) file.globals
+          in
+          (globals, g) :: acc
+        ) funcs [])
+    with Not_found | Failure _ -> None
+
+  (** recomputes the statement info for the current variant. Only the
+      functions touched by [edits] are revisited when possible; otherwise, or
+      if [edits] is not given, every file is. Only statements whose info
+      differs from the code bank get an override. *)
+  method private regen_stmt_info ?edits files =
     let reader sid = self#get_fault_space_info sid in
     let writer sid info =
       if (sid <> 0) && (info <> self#get_fault_space_info sid) then
-        hrep stmt_overrides sid info
+        stmt_overrides := IntMap.add sid info !stmt_overrides
+    in
+    let funcs =
+      match edits with
+      | Some(edits) -> self#edited_functions edits files
+      | None -> None
     in
-    StringMap.iter (fun _ file ->
-        self#internal_collect_stmt_info file reader writer
-      ) files
+    match funcs with
+    | Some(funcs) ->
+      liter (fun (globals, g) ->
+          self#internal_collect_global_stmt_info globals g reader writer
+        ) funcs
+    | None ->
+      StringMap.iter (fun _ file ->
+          self#internal_collect_stmt_info file reader writer
+        ) files
 
+  (* Loading a whole genome materializes the AST once: the genes are applied in
+     order to a single fresh copy of the code bank and the statement info is
+     regenerated once at the end, rather than once per gene. *)
   method set_genome g =
     self#updated();
     genome := [];
-    let files = lfoldl (fun _ gene -> self#add_gene gene) StringMap.empty g in
-    history := lmap fst !genome;
-    self#regen_stmt_info files
+    stmt_overrides := IntMap.empty ;
+    if g <> [] then begin
+      let files = self#get_current_files () in
+      let genes =
+        Stats2.time "rebuild files" (fun () ->
+            lfoldl (fun genes (h,id) ->
+                let gene = h, self#gene_id id in
+                self#apply_genes files [gene] ;
+                gene :: genes
+              ) [] g
+          ) ()
+      in
+      genome := lrev genes ;
+      patchCilRep_fileCache :=
+        Some(Oo.id self, lmap self#gene_to_crumb !genome, files) ;
+      self#regen_stmt_info ~edits:(lmap fst !genome) files
+    end ;
+    self#reset_history (lmap (fun gene -> fst gene, self#gene_to_name gene) !genome)
 
   method add_history h =
-    let files = self#add_gene (h,0) in
-    super#add_history h ;
-    self#regen_stmt_info files
-
-  (** Override method in [cachingRepresentation] to accommodate [patchCilRep]'s
-      genome. This must be kept in sync with [load_genome_from_string]. *)
-  method name () =
-    let genome = self#get_genome () in
-    if genome = [] then "original"
+    let gene = h, self#gene_id 0 in
+    let files = self#add_gene gene in
+    self#record_history h (self#gene_to_name gene) ;
+    self#regen_stmt_info ~edits:[h] files
+
+  (** The name of a [patchCilRep] is built from its genome rather than its
+      history. This must be kept in sync with [load_genome_from_string]. *)
+  method private gene_to_name (h,n) =
+    if !do_nested then
+      (self#history_element_to_str h) ^ "/" ^ (string_of_int n)
     else
-      let strs =
-        lmap (fun (h,n) ->
-            if !do_nested then
-              (self#history_element_to_str h) ^ "/" ^ (string_of_int n)
-            else
-              (self#history_element_to_str h)
-          ) genome
-      in
-      String.concat " " strs
+      (self#history_element_to_str h)
+
+  method private render_name parts = String.concat " " parts
 
   (** @param str history string, such as is printed out by fitness
       @raise Fail("unexpected history element") if the string contains something
@@ -2960,8 +3642,8 @@ class patchCilRep = object (self : 'self_type)
 
       let handler s expected funname =
         unexpected_num s expected funname ;
-        if not (hmem stmt_overrides s.sid) then
-          hrep stmt_overrides s.sid info ;
+        if not (IntMap.mem s.sid !stmt_overrides) then
+          stmt_overrides := IntMap.add s.sid info !stmt_overrides ;
       in
       visitCilStmt (new numVisitor stmt_count counter handler) new_s
     in
@@ -2990,6 +3672,9 @@ class patchCilRep = object (self : 'self_type)
               (sid,w')::localization, w
           ) ([], empty) !fault_localization
       in
+      (* always a new list, even if no SID was removed: [indexed_sources]
+         takes a physically unchanged list to mean that no other fault atom
+         changed, which is what keeps cached swap sources valid *)
       fault_localization := lrev localization ;
 
       visitCilStmt (object
@@ -3118,12 +3803,23 @@ class patchCilRep = object (self : 'self_type)
             (self#history_element_to_str e) ;
           [] *)
 
+  method private gene_to_crumb (h,n) = self#history_element_to_str h, n
+
+  (** applies the given genes, in order, to [files] in place *)
+  method private apply_genes files genes =
+    List.iter (fun gene ->
+        List.iter (fun xform ->
+            StringMap.iter (fun _ file ->
+                visitCilFileSameGlobals xform file
+              ) files
+          ) (self#internal_calculate_output_xform gene files)
+      ) genes
+
   method get_current_files () =
-    let gene_to_crumb (h,n) = self#history_element_to_str h, n in
     let rec is_prefix crumbs genes =
       match crumbs, genes with
       | [], _ -> true
-      | c::cs, g::gs when c = gene_to_crumb g -> is_prefix cs gs
+      | c::cs, g::gs when c = self#gene_to_crumb g -> is_prefix cs gs
       | _ -> false
     in
     Stats2.time "rebuild files" (fun () ->
@@ -3140,18 +3836,53 @@ class patchCilRep = object (self : 'self_type)
             fault_localization := !global_ast_info.fault_localization ;
             copy !global_ast_info.code_bank, [], self#get_genome()
         in
-        List.iter (fun gene ->
-            List.iter (fun xform ->
-                StringMap.iter (fun _ file ->
-                    visitCilFileSameGlobals xform file
-                  ) result
-              ) (self#internal_calculate_output_xform gene result)
-          ) genes ;
-        let crumbs = crumbs @ (lmap gene_to_crumb genes) in
+        self#apply_genes result genes ;
+        let crumbs = crumbs @ (lmap self#gene_to_crumb genes) in
         patchCilRep_fileCache := Some(Oo.id self, crumbs, result) ;
         result
       )()
 
+  method compute_localization () =
+    super#compute_localization () ;
+    (* --fault-scope may have dropped files from the code bank *)
+    patchCilRep_fileCache := None
+
+  (** with [--split-compile], compiles only the functions this variant's edits
+      touch (written as preprocessed source next to [exe_name]) and links them
+      against the shared object built by [split_base_object]. Falls back to
+      compiling [source_name] whenever the program or the edits do not allow
+      that. *)
+  method compile source_name exe_name =
+    let split =
+      if !split_compile && not !use_subdirs && !compiler_command = ""
+         && !min_script = None then
+        let files = self#get_current_files () in
+        let file_list map = StringMap.fold (fun _ f fs -> f :: fs) map [] in
+        match file_list files,
+              self#edited_functions (lmap fst (self#get_genome ())) files with
+        | [file], Some(funcs) ->
+          let edited =
+            lfoldl (fun edited (_, g) ->
+                match g with
+                | GFun(fd,_) -> IntSet.add fd.svar.vid edited
+                | _ -> edited
+              ) IntSet.empty funcs
+          in
+          let original = List.hd (file_list !global_ast_info.code_bank) in
+          (match split_base_object original with
+           | Some(obj) -> Some(obj, file, edited)
+           | None -> None)
+        | _ -> None
+      else None
+    in
+    match split with
+    | Some(obj, file, edited) ->
+      let unit_name = exe_name ^ ".i" in
+      output_cil_file unit_name (split_variant_file file edited) ;
+      self#internal_compile source_name
+        (String.concat " " (unit_name :: obj :: !scope_objects)) exe_name
+    | None -> super#compile source_name exe_name
+
   (**/**)
   (* computes the source buffers for this variant.
       @return (string option * string option) list pair of filename and string
@@ -3257,6 +3988,13 @@ class astCilRep = object(self)
     super#deserialize ?in_channel:in_channel ?global_info:global_info filename;
     base := copy !global_ast_info.code_bank
 
+  method compute_localization () =
+    super#compute_localization () ;
+    (* --fault-scope may have dropped files from the code bank *)
+    base :=
+      StringMap.filter (fun fname _ ->
+          StringMap.mem fname !global_ast_info.code_bank) !base
+
   method internal_copy () : 'self_type = {< base =  ref (copy !base) >}
 
   (**/**)
@@ -132,6 +132,29 @@ let debug_bad_cdiff_nodes () = begin
       List.iter (fun q -> Printf.printf "%s\n" q) y.cil_txt) bad_node_id_to_cdiff_node
 end
 
+(* Ids of the good nodes, sorted, so that the closest good node at or
+ * before a bad one is found by binary search rather than by walking
+ * down the id space one id at a time. Rebuilt by build_action_list. *)
+let good_node_index = ref [| |]
+
+let build_good_node_index () =
+  let ids = hfold (fun id _ acc -> id :: acc) node_id_to_cdiff_node [] in
+  good_node_index := Array.of_list (List.sort compare ids)
+
+(* nearest_good_id
+ * Returns the largest good node id no greater than node_id. *)
+let nearest_good_id node_id = begin
+  let index = !good_node_index in
+  let lo = ref 0 in
+  let hi = ref (Array.length index) in
+  while !lo < !hi do
+    let mid = (!lo + !hi) / 2 in
+    if index.(mid) <= node_id then lo := mid + 1 else hi := mid
+  done;
+  if !lo = 0 then raise Not_found;
+  index.(!lo - 1)
+end
+
 (* get_nearest_good_node
  * Gets the closest previous node with a valid line number of
  * a given node and returns it.
@@ -141,31 +164,21 @@ let get_nearest_good_node ht node_id = begin
   if (Hashtbl.mem node_id_to_cdiff_node node_id) then
     (Hashtbl.find node_id_to_cdiff_node node_id)
   else begin
-    let id_count = ref node_id in
-    while not (Hashtbl.mem node_id_to_cdiff_node !id_count) do
-      decr id_count;
-      (* Extraordinarily unlikely but this could result in infinite loop *)
-    done;
-    let parent_node = Hashtbl.find ht !id_count in
-    let found_flag = ref false in
-    let found_id = ref parent_node.nid in
+    let good_id = nearest_good_id node_id in
+    let parent_node = Hashtbl.find ht good_id in
+    (* We have to make sure the children are valid. If not we have to
+     * backtrack to the parent. *)
+    let rec last_good_child i =
+      if i < 0 then parent_node.nid
+      else if Hashtbl.mem node_id_to_cdiff_node parent_node.children.(i) then
+        parent_node.children.(i)
+      else last_good_child (i - 1)
+    in
     let the_id =
-      (* We have to make sure the children are valid. If not we have to
-       * backtrack to the parent. *)
       if (Array.length parent_node.children)>0 then
-        (
-          for i=((Array.length parent_node.children)-1) downto 0 do
-            let possible_val = Array.get parent_node.children i in
-            if not (!found_flag) then
-              (
-                if (Hashtbl.mem node_id_to_cdiff_node possible_val) then
-                  (found_flag := true; found_id := possible_val)
-              )
-          done;
-          !found_id
-        )
+        last_good_child ((Array.length parent_node.children)-1)
       else
-        !id_count
+        good_id
     in
     (Hashtbl.find node_id_to_cdiff_node the_id)
   end
@@ -177,6 +190,30 @@ end
  * as the number of trailing closing brackets to try to include,
  * or something like that. *)
 
+(* The lines of each original file, and for each line the first line
+ * at or after it that is not made up solely of closing brackets. Both
+ * are built in one backwards pass the first time a file is consulted,
+ * so bracket inclusion and text extraction never reread the file. *)
+type line_table = {
+  lines : string array ;
+  after_brackets : int array ;
+}
+
+let line_tables = hcreate 11
+
+let get_line_table filename =
+  ht_find line_tables filename (fun () ->
+      let lines = Array.of_list (get_lines filename) in
+      let num_lines = Array.length lines in
+      let after_brackets = Array.make (num_lines + 1) num_lines in
+      for i = num_lines - 1 downto 0 do
+        after_brackets.(i) <-
+          if List.for_all (fun x -> x="}") (Str.split whitespace lines.(i))
+          then after_brackets.(i+1)
+          else i
+      done;
+      { lines = lines ; after_brackets = after_brackets })
+
 (* Returns the last line containing only brackets after
  * a given line. Utility function to include extra lines
  * for inserts after a statement which does not include
@@ -186,53 +223,33 @@ let get_last_bracket_line filename starting_line = begin
    * brackets. If opening - closing = 0, then don't do any more inclusion.
    * If opening - closing > 0, take the difference as the max number of brackets
    * to include. *)
-  (*
-    let line_counter = ref starting_line in
-    let current_line = ref "" in
-    let brackets = ref true in
-    begin try
-    while (!brackets) do
-    current_line := (List.nth !source_code !line_counter);
-    let current_line_without_ws = Str.split whitespace !current_line in
-    List.iter (fun x -> if x<>"}" then brackets := false) current_line_without_ws;
-    if (!brackets) then incr line_counter;
-    done;
-    ();
-    with Failure _ -> ();
-    end;
-    !line_counter
-  *)
-
-
-  let file_lines = get_lines filename in
-  let rec walk current_line =
-    (* We have to stop before the end of the file, because an insert after the last line will screw up. *)
-    if current_line>=((List.length file_lines)) then begin
-      (List.length file_lines)
-    end
-    else begin
-      let this_line = (List.nth file_lines current_line) in
-      if List.for_all (fun x -> x="}") (Str.split whitespace this_line)
-      then begin
-        walk (current_line+1)
-      end
-      else begin
-        current_line
-      end
-    end
-  in
-  walk starting_line
-
+  let table = get_line_table filename in
+  (* We have to stop before the end of the file, because an insert after the
+   * last line will screw up. *)
+  if starting_line < 0 then invalid_arg "get_last_bracket_line";
+  if starting_line >= Array.length table.lines then Array.length table.lines
+  else table.after_brackets.(starting_line)
 end
 
 
 
 
+(* nth_good_child
+ * Returns the p-th (1-based) child of a node, if that child has a
+ * valid line number. *)
+let nth_good_child parent_node p =
+  let children = parent_node.children in
+  if p >= 1 && p <= Array.length children &&
+     Hashtbl.mem node_id_to_cdiff_node children.(p-1) then
+    Some (Hashtbl.find node_id_to_cdiff_node children.(p-1))
+  else None
+
 let build_action_list fn ht = begin
   (* TODO: Parse the file, and create an action for
    * each line. Action (x,y,z). See cdiff line 834 for
    * a template. This also must include line derivations
    * for "children." Look at notebook for an idea. *)
+  build_good_node_index ();
   let c = open_in fn in
   let the_file = ref "" in
   try
@@ -300,22 +317,10 @@ let build_action_list fn ht = begin
               (* The parent is good, but the children might not be. *)
             if (Hashtbl.mem node_id_to_cdiff_node nodeY.id) then begin
               let parent_node = Hashtbl.find ht nodeY.id in
-              let counter = ref 1 in
-              let child_id = ref 0 in
-              let p_temp = ref p in
-              let found_flag = ref false in
-              while (!p_temp)!=0 do
-                counter := 1;
-                child_id := 0;
-                Array.iter (fun child_ider ->
-                    if (!counter)=p then (child_id := child_ider; incr counter) else incr counter;
-                  ) parent_node.children ;
-                if (Hashtbl.mem node_id_to_cdiff_node !child_id) then (found_flag := true; p_temp := 0)
-                else decr p_temp ;
-              done;
               let prev_child =
-                if (!found_flag) then Hashtbl.find node_id_to_cdiff_node !child_id
-                else nodeY
+                match nth_good_child parent_node p with
+                | Some child -> child
+                | None -> nodeY
               in
               the_file := prev_child.filename;
               if (enable_bracket_inclusion) then (get_last_bracket_line !the_file prev_child.last_line)
@@ -325,26 +330,12 @@ let build_action_list fn ht = begin
              * get the nearest good one, if that's enabled. Otherwise just get the bad one. *)
             else begin
               let parent_node = Hashtbl.find ht nodeY.id in
-              let counter = ref 1 in
-              let child_id = ref 0 in
-              let p_temp = ref p in
-              let found_flag = ref false in
-              while (!p_temp)!=0 do
-                counter := 1;
-                child_id := 0;
-                Array.iter (fun child_ider ->
-                    if (!counter)=p then (child_id := child_ider; incr counter) else incr counter;
-                  ) parent_node.children ;
-                if (Hashtbl.mem node_id_to_cdiff_node !child_id) then (found_flag := true; p_temp := 0)
-                else decr p_temp ;
-              done;
               let the_node =
-                if (!found_flag) then Hashtbl.find node_id_to_cdiff_node !child_id
-                else
-                  (
-                    if (enable_nearest_good_node_search) then (get_nearest_good_node ht nodeY.id)
-                    else nodeY
-                  )
+                match nth_good_child parent_node p with
+                | Some child -> child
+                | None ->
+                  if (enable_nearest_good_node_search) then (get_nearest_good_node ht nodeY.id)
+                  else nodeY
               in
               the_file := the_node.filename;
               if (enable_bracket_inclusion) then
@@ -437,12 +428,10 @@ let _ =
   let build_node_tuple id =
     if (Hashtbl.mem node_id_to_line_list_fn id) then begin
       let (lr,f) = (Hashtbl.find node_id_to_line_list_fn id) in
-      if (List.length lr)!=0 then begin
-        let lineRange = ref lr in
-        lineRange := (List.sort (fun x y -> x - y) !lineRange);
-        let min = (List.hd !lineRange) in
-        let max = (List.nth !lineRange ((List.length !lineRange)-1)) in
-        Hashtbl.add verbose_node_info id (f,min,max)
+      if lr <> [] then begin
+        let first = lfoldl min (List.hd lr) lr in
+        let last = lfoldl max (List.hd lr) lr in
+        Hashtbl.add verbose_node_info id (f,first,last)
       end
       else
         Hashtbl.add verbose_node_info id (f,0,0)
@@ -466,12 +455,11 @@ end
 let initialize_node_info nid_to_cil_stmt_ht = begin
 
   let get_lines_from_file filename startline endline =
-    let lines = get_lines filename in
-    let max = List.length lines in
+    let lines = (get_line_table filename).lines in
+    let max = Array.length lines in
     if (startline<1 || endline>max) then []
     else
-      Array.to_list
-        (Array.sub (Array.of_list lines) (startline-1) (endline-startline+1))
+      Array.to_list (Array.sub lines (startline-1) (endline-startline+1))
   in
   let nid_to_string_list nid =
     try
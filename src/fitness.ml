@@ -61,6 +61,10 @@ let sample_strategy = ref "variant"
 
 let best_test_rule = ref "1 * test_fail_prob ; 1 * test_fail_count ; -1 * test_pass_count"
 
+let sequential_fitness = ref false
+let sequential_batch = ref 4
+let sequential_z = ref 1.96
+
 let _ =
   options := !options @ [
       "--negative-test-weight", Arg.Set_float negative_test_weight,
@@ -82,6 +86,15 @@ let _ =
 
       "--best-test-rule", Arg.Set_string best_test_rule,
       "X use X to rank possible tests in adaptive search";
+
+      "--sequential-fitness", Arg.Set sequential_fitness,
+      " run positive tests in batches and stop once the variant cannot be a repair and is clearly worse than the best so far (or, with --sample below 1.0, has run its sample). Default: false";
+
+      "--sequential-batch", Arg.Set_int sequential_batch,
+      "X run at least X positive tests per batch with --sequential-fitness. Default: 4";
+
+      "--sequential-z", Arg.Set_float sequential_z,
+      "X z-score of the pass rate bound used by --sequential-fitness. Default: 1.96";
     ]
 
 exception Test_Failed
@@ -89,8 +102,9 @@ exception Test_Failed
 (* utilities to help test fitness *)
 
 let get_rest_of_sample sample =
-  List.filter
-    (fun test -> not (List.mem test sample)) (1 -- !pos_tests)
+  let in_sample = Array.make (!pos_tests + 1) false in
+  liter (fun test -> in_sample.(test) <- true) sample ;
+  List.filter (fun test -> not in_sample.(test)) (1 -- !pos_tests)
 
 let test_one_rep (rep : ('a, 'b) Rep.representation) test_maker tests factor =
   let results = rep#test_cases (lmap test_maker tests) in
@@ -98,14 +112,36 @@ let test_one_rep (rep : ('a, 'b) Rep.representation) test_maker tests factor =
     (fun fitness (res,_) -> if res then fitness +. factor else fitness)
     0.0 results
 
+(* the negative tests and the positive sample are submitted together, so that
+   a parallel run does not wait for the slowest negative test before starting
+   on the positives *)
 let one_sample_fitness rep sample fac =
-  let neg_fitness =
-    test_one_rep rep (fun x -> Negative x) (1 -- !neg_tests) fac
+  let tests =
+    (lmap (fun x -> Negative x) (1 -- !neg_tests)) @
+    (lmap (fun x -> Positive x) sample)
   in
-  let pos_fitness =
-    test_one_rep rep (fun x -> Positive x) sample 1.0
+  List.fold_left2 (fun fitness test (res,_) ->
+      match test, res with
+      | Negative _, true -> fitness +. fac
+      | Positive _, true -> fitness +. 1.0
+      | _, _ -> fitness
+    ) 0.0 tests (rep#test_cases tests)
+
+(* runs the positive [tests] a batch (of --fitness-in-parallel tests) at a
+   time, stopping after the first batch with a failure. The variant cannot be
+   a repair at that point, so the remaining tests are not worth running. *)
+let test_until_failure rep tests =
+  let batch_size = max 1 !fitness_in_parallel in
+  let rec run fitness tests =
+    match tests with
+    | [] -> fitness
+    | _ ->
+      let batch, rest = split_nth tests batch_size in
+      let passed = test_one_rep rep (fun x -> Positive x) batch 1.0 in
+      if passed < float (llen batch) then fitness +. passed
+      else run (fitness +. passed) rest
   in
-  neg_fitness +. pos_fitness
+  run 0.0 tests
 
 let test_sample (rep) (sample) : float * float =
   let sample_size = llen sample in
@@ -117,13 +153,154 @@ let test_sample (rep) (sample) : float * float =
   let fitness = one_sample_fitness rep sample fac in
   if fitness < max_sample_fitness then fitness,fitness
   else
+    (* the full fitness is exact if the variant passes every test, and a lower
+       bound otherwise *)
     let rest_sample = get_rest_of_sample sample in
-    fitness, fitness +. (test_one_rep rep (fun x -> Positive x) rest_sample 1.0)
+    fitness, fitness +. (test_until_failure rep rest_sample)
 
+(* a partial Fisher-Yates shuffle: only the first [sample_size] positions are
+   shuffled, and the chosen tests are collected in ascending order *)
 let generate_random_sample sample_size =
-  let random_pos = random_order (1 -- !pos_tests) in
-  List.sort compare (first_nth random_pos sample_size)
-
+  let tests = Array.init !pos_tests (fun i -> i + 1) in
+  let sample_size = min sample_size !pos_tests in
+  let chosen = Array.make (!pos_tests + 1) false in
+  for i = 0 to sample_size - 1 do
+    let j = i + Random.int (!pos_tests - i) in
+    let t = tests.(j) in
+    tests.(j) <- tests.(i) ;
+    tests.(i) <- t ;
+    chosen.(t) <- true
+  done ;
+  List.filter (fun test -> chosen.(test)) (1 -- !pos_tests)
+
+
+(** parses --best-test-rule into a function from a test's metrics to its
+    priority. Priorities compare lowest first for the tests to run first. *)
+let best_test_scorer () =
+  let get_test_attr attr =
+    match attr with
+    | "test_pass_count" -> fun m -> m.pass_count
+    | "test_fail_count" -> fun m -> m.fail_count
+    | "test_fail_prob"  ->
+      fun m ->
+        let total = m.pass_count +. m.fail_count in
+        if total = 0. then 0. else m.fail_count /. total
+    | "test_cost" -> fun m -> m.cost
+    | _ ->
+      debug "fitness: ERROR: unknown test attribute %s\n" attr;
+      failwith "get_test_attr"
+  in
+  let rec interpret r rs = function
+    | ";" :: rest ->
+      interpret [] (r::rs) rest
+    | weight :: "*" :: attribute :: rest ->
+      let weight = my_float_of_string weight in
+      let attr = get_test_attr attribute in
+      interpret ((weight, attr) :: r) rs rest
+    | x :: _ ->
+      debug "fitness: ERROR: unknown command %S\n" x;
+      failwith "interpret"
+    | [] -> r::rs
+  in
+  let best_test_rules = Str.split space_regexp !best_test_rule in
+  let rules = List.rev (interpret [] [] best_test_rules) in
+  (* We negate the weight so that high priority weights will sort first
+     according to compare. *)
+  fun m ->
+    List.map
+      (fun r -> List.fold_left (fun sum (w, a) -> sum -. w *. a m) 0.0 r)
+      rules
+
+(** the Wilson score interval for a pass rate of [passed] out of [run] tests,
+    as (center, half width) *)
+let wilson_interval z passed run =
+  if run = 0 then 0.5, 0.5
+  else
+    let n = float run in
+    let p = (float passed) /. n in
+    let z2 = z *. z in
+    let denom = 1.0 +. (z2 /. n) in
+    let center = (p +. (z2 /. (2.0 *. n))) /. denom in
+    let half =
+      (z /. denom) *. (sqrt ((p *. (1.0 -. p) /. n) +. (z2 /. (4.0 *. n *. n))))
+    in
+    center, half
+
+(* the best lower bound on a variant's fitness seen so far by
+   --sequential-fitness. Point estimates of variants that stopped early are
+   biased upward, so comparing against them would cut off unlucky variants.
+   Worker processes pass theirs back to be merged (see [Search.in_workers]). *)
+let best_sequential_fitness = ref neg_infinity
+
+(** {b test_fitness_sequential} rep runs the negative tests, then the positive
+    tests in a random order and in batches of --sequential-batch (or
+    --fitness-in-parallel, if larger). After each batch it bounds the pass rate
+    of the positive tests, and stops early if the variant cannot be a repair
+    and either the upper bound on its fitness is below the best lower bound
+    seen so far, or it has run its sample. The sample is as many tests as
+    --sample asks for when that is below 1.0. Otherwise it is every positive
+    test, so that variants which fail only a few tests keep their place in
+    selection; they stop early only once the bound separates them from the
+    best. Once the sample (or, without one, the first batch) is complete, the
+    remaining tests are run in --best-test-rule order.
+
+    @return (estimate, fitness, margin) where [estimate] extrapolates the
+    pass rate to every positive test, [margin] is the half width of its
+    interval, and [fitness] is the maximum fitness only for a repair *)
+let test_fitness_sequential rep =
+  let fac =
+    (float !pos_tests) *. !negative_test_weight /. (float !neg_tests) in
+  let neg_passed =
+    test_one_rep rep (fun x -> Negative x) (1 -- !neg_tests) 1.0 in
+  let neg_fitness = neg_passed *. fac in
+  let all_negatives = neg_passed >= float !neg_tests in
+  let batch_size = max 1 (max !sequential_batch !fitness_in_parallel) in
+  let min_tests =
+    if !sample < 1.0 then
+      min (int_of_float (max ((float !pos_tests) *. !sample) 1.0)) !pos_tests
+    else !pos_tests
+  in
+  (* the first batch is random even without a sample, so that the estimate
+     has something unbiased to go on *)
+  let sampled = if !sample < 1.0 then min_tests else min batch_size min_tests in
+  let order = Array.of_list (random_order (1 -- !pos_tests)) in
+  let priority = best_test_scorer () in
+  let rest =
+    Array.map (fun t -> priority (rep#test_metrics (Positive t)), t)
+      (Array.sub order sampled (!pos_tests - sampled))
+  in
+  Array.stable_sort (fun (a,_) (b,_) -> compare a b) rest ;
+  Array.iteri (fun i (_,t) -> order.(sampled + i) <- t) rest ;
+  let estimate passed run =
+    if run = 0 then neg_fitness +. (float !pos_tests)
+    else neg_fitness +. (float passed) /. (float run) *. (float !pos_tests)
+  in
+  let rec run_batches passed run =
+    let center, half = wilson_interval !sequential_z passed run in
+    let upper = neg_fitness +. (center +. half) *. (float !pos_tests) in
+    let repair = all_negatives && passed = run in
+    if run >= !pos_tests
+    || (not repair && run >= min_tests)
+    || (not repair && run > 0 && upper < !best_sequential_fitness) then
+      passed, run, half
+    else begin
+      let batch =
+        Array.to_list
+          (Array.sub order run (min batch_size (!pos_tests - run))) in
+      let batch_passed = test_one_rep rep (fun x -> Positive x) batch 1.0 in
+      run_batches (passed + int_of_float batch_passed) (run + llen batch)
+    end
+  in
+  let passed, run, half = run_batches 0 0 in
+  let estimate = estimate passed run in
+  let margin = if run >= !pos_tests then 0.0 else half *. (float !pos_tests) in
+  let max_fitness = (float !pos_tests) +. ((float !neg_tests) *. fac) in
+  let fitness =
+    if all_negatives && passed = !pos_tests then max_fitness else estimate
+  in
+  best_sequential_fitness :=
+    max !best_sequential_fitness (estimate -. margin) ;
+  estimate, fitness, margin
 
 (* three different sampling strategies *)
 let test_fitness_variant rep =
@@ -204,40 +381,7 @@ let test_to_first_failure ?(allowed=fun _ -> true) (rep :('a,'b) Rep.representat
   if PriorityQueue.is_empty !test_model.queue then begin
     (* First run of this function: initialize the model with the user-defined
        best_test_rule *)
-    let get_test_attr attr =
-      match attr with
-      | "test_pass_count" -> fun m -> m.pass_count
-      | "test_fail_count" -> fun m -> m.fail_count
-      | "test_fail_prob"  ->
-        fun m ->
-          let total = m.pass_count +. m.fail_count in
-          if total = 0. then 0. else m.fail_count /. total
-      | "test_cost" -> fun m -> m.cost
-      | _ ->
-        debug "fitness: ERROR: unknown test attribute %s\n" attr;
-        failwith "get_test_attr"
-    in
-    let rec interpret r rs = function
-      | ";" :: rest ->
-        interpret [] (r::rs) rest
-      | weight :: "*" :: attribute :: rest ->
-        let weight = my_float_of_string weight in
-        let attr = get_test_attr attribute in
-        interpret ((weight, attr) :: r) rs rest
-      | x :: _ ->
-        debug "fitness: ERROR: unknown command %S\n" x;
-        failwith "interpret"
-      | [] -> r::rs
-    in
-    let best_test_rules = Str.split space_regexp !best_test_rule in
-    let rules = List.rev (interpret [] [] best_test_rules) in
-    let apply_rules m =
-      (* We negate the weight so that high priority weights will sort first
-         according to compare. *)
-      List.map
-        (fun r -> List.fold_left (fun sum (w, a) -> sum -. w *. a m) 0.0 r)
-        rules
-    in
+    let apply_rules = best_test_scorer () in
     let queue =
       let ids =
         if !single_fitness then [0] else 1 -- (!neg_tests + !pos_tests) in
@@ -309,12 +453,19 @@ let test_fitness generation (rep : ('a,'b) Rep.representation) =
     let fac =
       (float !pos_tests) *. !negative_test_weight /. (float !neg_tests) in
     let max_fitness = (float !pos_tests) +. ((float !neg_tests) *. fac) in
-    let print_info fitness rest =
-      (match !sample_strategy,rest with
-         "all",Some((generation_fitness,_),(variant_fitness,_)) when !sample < 1.0 ->
+    (* [bounded]: unless it is a repair, a sampled variant stops at the first
+       failing batch of the tests outside its sample (see [test_sample]), so
+       its fitness is only a lower bound *)
+    let print_info fitness rest margin bounded =
+      (match !sample_strategy,rest,margin with
+         "all",Some((generation_fitness,_),(variant_fitness,_)),_ when !sample < 1.0 ->
          debug ~force_gui:true "\t%3g\t%3g\t%3g %s"
            fitness generation_fitness variant_fitness (rep#name ())
-       | _,_ ->
+       | _,_,Some(margin) when margin > 0.0 ->
+         debug ~force_gui:true "\t%3g +/- %g %s" fitness margin (rep#name ())
+       | _,_,_ when bounded && fitness < max_fitness ->
+         debug ~force_gui:true "\t>=%3g %s" fitness (rep#name ())
+       | _,_,_ ->
          debug ~force_gui:true "\t%3g %s" fitness (rep#name ()));
       if !print_source_name then
         List.iter (fun name -> debug " %s" name) rep#source_name;
@@ -326,19 +477,25 @@ let test_fitness generation (rep : ('a,'b) Rep.representation) =
 
     (* rest here is the additional data provided by test_fitness_all_three, when
        applicable *)
-    let (sample_fitness, fitness),rest =
+    let (sample_fitness, fitness),rest,margin,bounded =
       match (rep#fitness()) with
-      | Some(f) -> (f,f),None
+      | Some(f) -> (f,f),None,None,false
+      | None when !sequential_fitness ->
+        let estimate, fitness, margin = test_fitness_sequential rep in
+        (estimate, fitness), None, Some(margin), false
       | None ->
         if !sample < 1.0 then
           match !sample_strategy with
-          | "generation" -> test_fitness_generation rep generation, None
-          | "variant" -> test_fitness_variant rep, None
-          | "all" -> test_fitness_all_three rep generation
+          | "generation" ->
+            test_fitness_generation rep generation, None, None, true
+          | "variant" -> test_fitness_variant rep, None, None, true
+          | "all" ->
+            let fitness, rest = test_fitness_all_three rep generation in
+            fitness, rest, None, false
         else
-          test_fitness_all rep, None
+          test_fitness_all rep, None, None, false
     in
-    print_info fitness rest;
+    print_info fitness rest margin bounded;
     (* debugging for --coverage-per-test
        if !Rep.coverage_per_test then begin
        let tests = rep#tests_visiting_edited_atoms () in
@@ -102,12 +102,79 @@ type 'a redirect =
   | UseChannel of 'a            (** use the given channel *)
   | UseDescr of Unix.file_descr (** use the given file descriptor *)
 
+(** {6 Garbage Collection} *)
+
+(**/**)
+let gc_fixed = ref false
+let gc_compact_overhead = ref 100
+(**/**)
+
+(* GC counters at the previous call to [gc_tune] *)
+let gc_last = ref None
+
+(* [gc_tune] doubles the minor heap up to this many words (64 MB on a 64-bit
+   machine) and [space_overhead] up to this percentage *)
+let gc_max_minor_heap = 8 * 1024 * 1024
+let gc_max_space_overhead = 320
+
+(** [gc_tune ()] adapts the garbage collector to the work done since it was
+    last called. If more than a tenth of the minor heap survives into the
+    major heap, short-lived values are being promoted before they die, so the
+    minor heap is doubled. If a major cycle finishes every few minor
+    collections, the major collector is mostly re-marking the same live data,
+    so [space_overhead] is doubled. The heap is compacted only when its free
+    space exceeds [--gc-compact-overhead] percent of the live data.
+
+    With [--gc-fixed], the heap is instead compacted every time, and the
+    collector settings are left alone. *)
+let gc_tune () =
+  if !gc_fixed then Stats2.time "gc compact" Gc.compact ()
+  else begin
+    let now = Gc.quick_stat () in
+    (match !gc_last with
+     | Some(last) ->
+       let ctrl = Gc.get () in
+       let minor_words = now.Gc.minor_words -. last.Gc.minor_words in
+       let promoted = now.Gc.promoted_words -. last.Gc.promoted_words in
+       let minors = now.Gc.minor_collections - last.Gc.minor_collections in
+       let majors = now.Gc.major_collections - last.Gc.major_collections in
+       let minor_heap_size =
+         if promoted > 0.1 *. minor_words
+         && ctrl.Gc.minor_heap_size < gc_max_minor_heap then
+           2 * ctrl.Gc.minor_heap_size
+         else ctrl.Gc.minor_heap_size
+       in
+       let space_overhead =
+         if majors > 0 && minors < 10 * majors
+            && ctrl.Gc.space_overhead < gc_max_space_overhead then
+           2 * ctrl.Gc.space_overhead
+         else ctrl.Gc.space_overhead
+       in
+       if minor_heap_size <> ctrl.Gc.minor_heap_size
+       || space_overhead <> ctrl.Gc.space_overhead then begin
+         debug "gc: minor heap %d words, space overhead %d%%\n"
+           minor_heap_size space_overhead ;
+         Gc.set { ctrl with Gc.minor_heap_size = minor_heap_size ;
+                            Gc.space_overhead = space_overhead }
+       end
+     | None -> ()) ;
+    (* Gc.stat walks the heap, which is still far cheaper than compacting *)
+    let stat = Stats2.time "gc stat" Gc.stat () in
+    if stat.Gc.free_words * 100 > stat.Gc.live_words * !gc_compact_overhead
+    then begin
+      debug "gc: compacting (%d live, %d free words in %d fragments)\n"
+        stat.Gc.live_words stat.Gc.free_words stat.Gc.free_blocks ;
+      Stats2.time "gc compact" Gc.compact ()
+    end ;
+    gc_last := Some(Gc.quick_stat ())
+  end
+
 (**/**)
-(** Keeps track of how many calls were made to [popen]. We want to force the
-    garbage collector to run every so often, since our process may be using a
+(** Keeps track of how many calls were made to [popen]. We want to check the
+    garbage collector every so often, since our process may be using a
     significant amount of reclaimable memory such that a fork cannot
-    succeed. Initialized to -1 so that the garbage collector runs immediately
-    after preprocessing.*)
+    succeed. Initialized to -1 so that the check runs immediately after
+    preprocessing.*)
 let popen_gc_count = ref (-1)
 (**/**)
 
@@ -164,7 +231,7 @@ let popen ?(stdin=Keep) ?(stdout=Keep) ?(stderr=Keep) cmd args =
   incr popen_gc_count ;
   if (!popen_gc_count == 0) || (!popen_gc_count > 1000) then begin
     popen_gc_count := 0;
-    Gc.compact ();
+    gc_tune ();
   end;
   let pid = Unix.fork () in
   if pid = 0 then begin
@@ -184,6 +251,111 @@ let system cmd =
   let _, status = Unix.waitpid [] p.pid in
   status
 
+(** [system_cpu name cmd] is [system cmd], but also returns the CPU time (user
+    plus system) the command used, which is recorded in [Stats2] under
+    [name]. Unlike the elapsed time, this does not depend on what else is
+    running. *)
+let system_cpu name cmd =
+  let before = Stats2.child_cpu_time () in
+  let status = system cmd in
+  let cpu = Stats2.child_cpu_time () -. before in
+  Stats2.note_child name cpu ;
+  status, cpu
+
+(** true in a process created by [fork_worker]. Clean-up code registered with
+    [at_exit] by the main process (saving caches, printing statistics) should
+    not run when such a worker finishes. *)
+let in_worker = ref false
+
+(** [fork_worker f x] computes [f x] in a forked copy of this process.
+
+    @return the pid of the worker and a channel from which the result can be
+    read with [input_value]. The channel is at end-of-file with no result if
+    [f x] raised an exception. *)
+let fork_worker f x =
+  let fd_in, fd_out = Unix.pipe () in
+  flush_all () ;
+  let pid = Unix.fork () in
+  if pid = 0 then begin
+    in_worker := true ;
+    Unix.close fd_in ;
+    let chan = Unix.out_channel_of_descr fd_out in
+    let status =
+      try
+        output_value chan (f x) ; 0
+      with _ -> 1
+    in
+    close_out chan ;
+    exit status
+  end else begin
+    Unix.close fd_out ;
+    pid, Unix.in_channel_of_descr fd_in
+  end
+
+(** [parallel_iter_ordered workers f report xs] computes [f i x] for the [i]th
+    element [x] of [xs], using at most [workers] processes from [fork_worker]
+    at a time. [report x result] is called in the parent in the order of [xs],
+    as soon as the result for [x] and all of its predecessors are known.
+    [result] is [None] if the worker failed. If [report] raises an exception,
+    any workers still running are killed before it is re-raised. *)
+let parallel_iter_ordered workers f report xs =
+  let jobs = Array.of_list xs in
+  let num_jobs = Array.length jobs in
+  let results = Array.make num_jobs None in
+  let running = ref [] in
+  let next_job = ref 0 in
+  let next_report = ref 0 in
+  let descr (_,_,chan) = Unix.descr_of_in_channel chan in
+  (* a signal (say, SIGCHLD from another child) interrupts the wait; it is not
+     an error *)
+  let rec wait_ready () =
+    try Unix.select (List.map descr !running) [] [] (-1.0)
+    with Unix.Unix_error(Unix.EINTR,_,_) -> wait_ready ()
+  in
+  let rec wait_pid pid =
+    try ignore (Unix.waitpid [] pid)
+    with Unix.Unix_error(Unix.EINTR,_,_) -> wait_pid pid
+  in
+  let reap (pid, i, chan) =
+    results.(i) <- Some(try Some(input_value chan) with _ -> None) ;
+    close_in chan ;
+    wait_pid pid
+  in
+  try
+    while !next_report < num_jobs do
+      while !next_job < num_jobs && (List.length !running) < workers do
+        let i = !next_job in
+        let pid, chan = fork_worker (f i) jobs.(i) in
+        running := (pid, i, chan) :: !running ;
+        incr next_job
+      done ;
+      if results.(!next_report) = None then begin
+        let ready, _, _ = wait_ready () in
+        let finished, still_running =
+          List.partition (fun w -> List.mem (descr w) ready) !running in
+        running := still_running ;
+        List.iter reap finished
+      end ;
+      let rec report_ready () =
+        if !next_report < num_jobs then
+          match results.(!next_report) with
+          | Some(result) ->
+            let x = jobs.(!next_report) in
+            incr next_report ;
+            report x result ;
+            report_ready ()
+          | None -> ()
+      in
+      report_ready ()
+    done
+  with e ->
+    List.iter (fun (pid, _, chan) ->
+        (try Unix.kill pid Sys.sigterm with _ -> ()) ;
+        close_in_noerr chan ;
+        (try ignore (Unix.waitpid [] pid) with _ -> ())
+      ) !running ;
+    raise e
+
 (** {6 Utility Functions} *)
 (** return a copy of 'lst' where each element occurs once *)
 let uniq lst =
@@ -431,6 +603,16 @@ let options = ref [
 
     "--quiet", Arg.Set quiet, " disable all debug output. quiet";
 
+    "--gc-fixed", Arg.Set gc_fixed,
+    " compact the heap on fixed triggers; do not tune the GC";
+
+    "--gc-compact-overhead",
+    Arg.Int (fun x ->
+        if x <= 0 then
+          raise (Arg.Bad "--gc-compact-overhead: X must be positive")
+        else gc_compact_overhead := x),
+    "X compact when free heap exceeds X% of live data (X > 0). Default: 100";
+
   ]
 
 let validators : (unit -> unit) list ref = ref []
@@ -580,6 +762,22 @@ let read_process command =
   ignore (Unix.close_process_in in_channel);
   Buffer.contents buffer
 
+(** the number of online processors, or 1 if it cannot be determined *)
+let num_processors = lazy (
+  try
+    max 1 (int_of_string
+             (String.trim (read_process "getconf _NPROCESSORS_ONLN 2>/dev/null")))
+  with _ -> 1)
+
+(** [with_seed seed f] calls [f ()] with the random number generator seeded
+    with [seed], and then restores the caller's random state *)
+let with_seed seed f =
+  let state = Random.get_state () in
+  Random.init seed ;
+  let result = try f () with e -> Random.set_state state ; raise e in
+  Random.set_state state ;
+  result
+
 (** Utility function to read 'command-line arguments' from a file.  This allows
     us to avoid the old 'ldflags' file hackery, etc. *)
 let parse_options_in_file (file : string) : unit =
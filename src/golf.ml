@@ -312,6 +312,16 @@ let no_sub = ref false
 (** If true, treat indexed edges as regular subtyping *)
 let analyze_mono = ref true
 
+(** If true (and [analyze_mono] is set), unify the labels on each cycle of
+    subtyping edges as the cycle is closed *)
+let collapse_cycles = ref true
+
+(** The number of labels the search for a cycle may visit *)
+let cycle_search_limit = ref 64
+
+(** True while [solve_constraints] is draining the worklists *)
+let solving = ref false
+
 (** A list of equality constraints. *)
 let eq_worklist : tconstraint Q.t = Q.create ()
 
@@ -1016,11 +1026,44 @@ and leq_label (l,(i, p), l') : unit =
     li'.n_lbounds <- B.add (make_bound (i, l)) li'.n_lbounds
   | Sub ->
     if U.equal (l, l') then ()
+    else if !collapse_cycles && !analyze_mono && collapse_sub_cycle (l, l')
+    then ()
     else
       begin
         li.m_ubounds <- B.add (make_bound(0, l')) li.m_ubounds;
         li'.m_lbounds <- B.add (make_bound(0, l)) li'.m_lbounds
       end
+(** If [l'] already flows to [l] along subtyping edges, [l <= l'] closes a
+    cycle on which every label has the same points-to set, so the labels on
+    it are unified with [l] and true is returned. The search gives up after
+    [cycle_search_limit] labels; a missed cycle only costs time. *)
+and collapse_sub_cycle (l, l' : label * label) : bool =
+  let visited = H.create 16 in
+  let budget = ref !cycle_search_limit in
+  (* the labels on a path from [x] to [l], starting with [x] *)
+  let rec search x =
+    if U.equal (x, l) then Some []
+    else if H.mem visited (get_label_stamp x) || !budget <= 0 then None
+    else begin
+      H.add visited (get_label_stamp x) () ;
+      decr budget ;
+      let rec search_bounds = function
+          [] -> None
+        | b :: rest ->
+          match search b.info with
+            Some path -> Some (x :: path)
+          | None -> search_bounds rest
+      in
+      search_bounds (B.elements (find x).m_ubounds)
+    end
+  in
+  match search l' with
+    Some cycle ->
+    if !debug_constraints then
+      Printf.printf "collapsing a cycle of %d labels\n" (List.length cycle + 1);
+    List.iter (fun x -> unify_label (l, x)) cycle;
+    true
+  | None -> false
 and add_constraint_int (c : tconstraint) (toplev : bool) =
   if !debug_constraints && toplev then
     begin
@@ -1035,7 +1078,7 @@ and add_constraint_int (c : tconstraint) (toplev : bool) =
       Unification _ -> Q.add c eq_worklist
     | Leq _ -> Q.add c leq_worklist
   end;
-  solve_constraints ()
+  if not !solving then solve_constraints ()
 and add_constraint (c : tconstraint) =
   add_constraint_int c false
 and add_toplev_constraint (c : tconstraint) =
@@ -1051,21 +1094,27 @@ and fetch_constraint () : tconstraint option =
   try Some (Q.take eq_worklist)
   with Q.Empty -> (try Some (Q.take leq_worklist)
                    with Q.Empty -> None)
-(** The main solver loop. *)
+(** The main solver loop. Constraints induced while solving are only queued;
+    this loop drains them, so solving never recurses. *)
 and solve_constraints () : unit =
-  match fetch_constraint () with
-    Some c ->
-    begin
-      match c with
-        Unification (t, t') -> unify_int (t, t')
-      | Leq (t, (i, p), t') ->
-        if !no_sub then unify_int (t, t')
-        else
-        if !analyze_mono then leq_int (t, (0, Sub), t')
-        else leq_int (t, (i, p), t')
-    end;
-    solve_constraints ()
-  | None -> ()
+  let rec loop () =
+    match fetch_constraint () with
+      Some c ->
+      begin
+        match c with
+          Unification (t, t') -> unify_int (t, t')
+        | Leq (t, (i, p), t') ->
+          if !no_sub then unify_int (t, t')
+          else
+          if !analyze_mono then leq_int (t, (0, Sub), t')
+          else leq_int (t, (i, p), t')
+      end;
+      loop ()
+    | None -> ()
+  in
+  solving := true;
+  (try loop () with e -> solving := false; raise e);
+  solving := false
 
 
 (***********************************************************************)
@@ -1231,7 +1280,13 @@ let return (t : tau) (t' : tau) =
 (*                                                                     *)
 (***********************************************************************)
 
-let make_summary = leq_label
+(** Summaries are found while tabulating paths, which assumes the labels it
+    has seen stay distinct, so they never collapse cycles. *)
+let make_summary (l, ip, l') =
+  let collapse = !collapse_cycles in
+  collapse_cycles := false;
+  (try leq_label (l, ip, l') with e -> collapse_cycles := collapse; raise e);
+  collapse_cycles := collapse
 
 let path_signature k l l' b : int list =
   let ksig =
@@ -58,6 +58,10 @@ let time_at_start = Unix.gettimeofday ()
 let describe_machine = ref false
 let oracle_genome = ref ""
 let show_version  = ref false
+let campaign_seeds = ref ""
+let campaign_configs = ref ""
+let campaign_workers = ref 1
+let campaign_out = ref "repair.campaign"
 
 let _ =
   options := !options @
@@ -92,15 +96,243 @@ let _ =
                "--disable-aslr", Arg.Set Rep.disable_aslr,
                " Disable ASLR during test runtime";
 
+               "--campaign-seeds", Arg.Set_string campaign_seeds,
+               "X load the subject once and search with each of the comma-separated seeds X" ;
+
+               "--campaign-configs", Arg.Set_string campaign_configs,
+               "X load the subject once and search with each line of options in file X" ;
+
+               "--campaign-workers", Arg.Set_int campaign_workers,
+               "X run up to X campaign searches at once. Default: 1" ;
+
+               "--campaign-out", Arg.Set_string campaign_out,
+               "X write one record per campaign search to X. Default: repair.campaign" ;
+
              ]
 
 
+(** {b search} rep population applies the requested search strategies in
+    order, starting from [rep] and the (possibly empty) incoming [population].
+    Search will abort if it receives an unrecognized search strategy, and
+    raises [Search.Found_repair] if a repair is found. *)
+let search (rep :('a,'b) Rep.representation) population =
+  (* Apply the requested search strategies in order. Typically there
+   * is only one, but they can be chained. *)
+  match !search_strategy with
+  | "dist" | "distributed" | "dist-net" | "net" | "dn" ->
+    Network.distributed_client rep population
+  | "brute" | "brute_force" | "bf" ->
+    Search.brute_force_1 rep population
+  | "geom" | "geometric" ->
+    Search.geometric rep population
+  | "ww" | "ww_adaptive" | "adaptive" ->
+    Search.ww_adaptive_1 rep population
+  | "ww_prodiv" | "prodiv" | "pd-exploit" ->
+    Search.pd_exploit rep population
+  | "mjk_prodiv" | "pd" | "pd-explore" ->
+    Search.pd_explore rep population
+  | "ga" | "gp" | "genetic" ->
+    if not (GPPopulation.sanity (rep#variable_length)) then
+      abort "Incompatable representation and crossover types, aborting";
+    Search.genetic_algorithm rep population
+  | "gasga" ->
+    if not (GPPopulation.sanity (rep#variable_length)) then
+      abort "Incompatable representation and crossover types, aborting";
+    Search.gasga rep population
+  | "ssga" | "steady-state" ->
+    if not (GPPopulation.sanity (rep#variable_length)) then
+      abort "Incompatable representation and crossover types, aborting";
+    Search.steady_state_ga rep population
+  | "multiopt" | "ngsa_ii" ->
+    Multiopt.ngsa_ii rep population
+  | "mutrb" | "neut" | "neutral" ->
+    Search.neutral_variants rep
+  | "oracle" ->
+    assert(!oracle_genome <> "");
+    Search.oracle_search rep !oracle_genome;
+  | "pd-oracle" ->
+    assert(!oracle_genome <> "");
+    Search.pd_oracle_search rep !oracle_genome;
+  | "seq" ->
+    assert(!oracle_genome <> "");
+    Search.sequence rep !oracle_genome
+  | "walk" | "neutral_walk" ->
+    Search.neutral_walk rep population
+  | x -> abort "unrecognized search strategy: %s\n" x
+
+(** test counters of different campaign runs start this far apart, so that
+    concurrent runs never compile variants to the same file names *)
+let campaign_counter_stride = 1000000
+
+(** options that only take effect while the subject is loaded and localized,
+    which a campaign does once before any run starts *)
+let load_time_options = [
+  "--prefix"; "--rep"; "--rep-cache"; "--no-rep-cache"; "--compiler";
+  "--compiler-command"; "--compiler-opts"; "--preprocessor"; "--split-compile";
+  "--fault-scheme"; "--fault-file"; "--fault-path"; "--fault-path-per-test";
+  "--fix-scheme"; "--fix-file"; "--fix-path"; "--fix-path-per-test";
+  "--coverage-info"; "--coverage-per-test"; "--regen-paths"; "--flatten-path";
+  "--mt-cov"; "--fault-scope"; "--fault-scope-files"; "--incoming-pop";
+  "--campaign-seeds"; "--campaign-configs"; "--campaign-workers";
+  "--campaign-out";
+]
+
+(** splits a line of campaign options into arguments at unquoted blanks, as a
+    shell would: single quotes keep everything up to the next one, double
+    quotes keep everything but a backslash-escaped quote or backslash, and a
+    backslash elsewhere keeps the character after it. *)
+let split_arguments line =
+  let n = String.length line in
+  let words = ref [] in
+  let word = Buffer.create 80 in
+  let in_word = ref false in
+  let add c = in_word := true ; Buffer.add_char word c in
+  let finish () =
+    if !in_word then begin
+      words := Buffer.contents word :: !words ;
+      Buffer.clear word ;
+      in_word := false
+    end
+  in
+  let unterminated () =
+    abort "main: unterminated quote in campaign options: %s\n" line
+  in
+  let rec plain i =
+    if i < n then
+      match line.[i] with
+      | ' ' | '\t' -> finish () ; plain (i + 1)
+      | '\'' -> in_word := true ; single (i + 1)
+      | '"' -> in_word := true ; double (i + 1)
+      | '\\' when i + 1 < n -> add line.[i + 1] ; plain (i + 2)
+      | c -> add c ; plain (i + 1)
+  and single i =
+    if i >= n then unterminated ()
+    else if line.[i] = '\'' then plain (i + 1)
+    else begin add line.[i] ; single (i + 1) end
+  and double i =
+    if i >= n then unterminated ()
+    else
+      match line.[i] with
+      | '"' -> plain (i + 1)
+      | '\\' when i + 1 < n && (line.[i + 1] = '"' || line.[i + 1] = '\\') ->
+        add line.[i + 1] ; double (i + 2)
+      | c -> add c ; double (i + 1)
+  in
+  plain 0 ;
+  finish () ;
+  lrev !words
+
+(** how a campaign run ended *)
+type campaign_outcome =
+  | Repaired of string
+  | No_repair
+  | Raised of string
+
+(** {b campaign} rep population runs one search per campaign seed and
+    configuration (every configuration is run with every seed) in worker
+    processes forked from this one, so the subject is parsed, localized and
+    loaded only once and is shared copy-on-write. Up to [--campaign-workers]
+    searches run at once. The test results of each run are merged into this
+    process's test cache as it finishes (runs that are live at the same time
+    can share results through [--nht-server]), and one tab-separated record
+    per run is written to [--campaign-out]. A run that raises an exception is
+    recorded as such, with the test results and evaluations it got to.
+    Configurations that set one of the [load_time_options] are rejected
+    before any run starts. *)
+let campaign (rep :('a,'b) Rep.representation) population =
+  let seeds =
+    if !campaign_seeds = "" then [ !random_seed ]
+    else
+      lmap (fun seed -> int_of_string (String.trim seed))
+        (Str.split comma_regexp !campaign_seeds)
+  in
+  let configs =
+    if !campaign_configs = "" then [ "", [] ]
+    else
+      lmap (fun line -> line, split_arguments line)
+        (lfilt (fun line -> line <> "" && line.[0] <> '#')
+           (lmap String.trim (get_lines !campaign_configs)))
+  in
+  liter (fun (line, args) ->
+      liter (fun arg ->
+          let name =
+            try String.sub arg 0 (String.index arg '=') with Not_found -> arg
+          in
+          if List.mem name load_time_options then
+            abort "main: %s takes effect only when the subject is loaded; it cannot vary across a campaign: %s\n"
+              name line
+        ) args
+    ) configs ;
+  let runs =
+    lflatmap (fun config -> lmap (fun seed -> seed, config) seeds) configs
+  in
+  let run k (seed, (config, args)) =
+    let start = Unix.gettimeofday () in
+    let evals_before = Rep.num_test_evals_ignore_cache () in
+    let compile_failures_before = !Rep.compile_failures in
+    random_seed := seed ;
+    Rep.test_counter := (k + 1) * campaign_counter_stride ;
+    Rep.no_test_cache := true ;
+    Rep.test_cache_journal := Some([]) ;
+    Search.repair_name := sprintf "repair.%d" k ;
+    let outcome =
+      try
+        if args <> [] then begin
+          Arg.current := 0 ;
+          Arg.parse_argv (Array.of_list (Sys.argv.(0) :: args))
+            (Arg.align !options) (fun _ -> ()) usageMsg
+        end ;
+        Random.init !random_seed ;
+        debug_out := open_out (sprintf "repair.debug.%d.%d" k !random_seed) ;
+        debug "Campaign run %d: seed %d, options %S\n" k !random_seed config ;
+        search rep population ;
+        debug "\nNo repair found.\n" ;
+        No_repair
+      with
+      | Search.Found_repair(name) -> Repaired(name)
+      | e ->
+        debug "Campaign run %d: %s\n" k (Printexc.to_string e) ;
+        Raised(Printexc.to_string e)
+    in
+    if !debug_out != stdout then close_out !debug_out ;
+    debug_out := stdout ;
+    !random_seed, outcome, Rep.num_test_evals_ignore_cache () - evals_before,
+    !Rep.compile_failures - compile_failures_before,
+    Unix.gettimeofday () -. start,
+    Rep.test_cache_export ()
+  in
+  let fout = open_out !campaign_out in
+  output_string fout
+    "run\tseed\toptions\toutcome\trepair\ttest_evals\tcompile_failures\tseconds\texception\n" ;
+  let k = ref 0 in
+  let one_line =
+    String.map (fun c -> if c = '\t' || c = '\n' then ' ' else c) in
+  let report (seed, (config, _)) result =
+    (match result with
+     | Some(seed, outcome, evals, compile_failures, seconds, entries) ->
+       Rep.test_cache_merge entries ;
+       let outcome, repair, raised =
+         match outcome with
+         | Repaired(name) -> "repaired", name, ""
+         | No_repair -> "no-repair", "", ""
+         | Raised(e) -> "exception", "", one_line e
+       in
+       fprintf fout "%d\t%d\t%s\t%s\t%s\t%d\t%d\t%g\t%s\n" !k seed config
+         outcome repair evals compile_failures seconds raised
+     | None ->
+       fprintf fout "%d\t%d\t%s\tfailed\t\t\t\t\t\n" !k seed config) ;
+    flush fout ;
+    incr k
+  in
+  debug "main: running %d campaign searches\n" (llen runs) ;
+  parallel_iter_ordered !campaign_workers run report runs ;
+  close_out fout
+
 (** {b process} base_file_name extension new_representation conducts the repair
     search on a base representation.  It loads the representation in
     new_representation, constructs the incoming population if applicable, and
     applies the search strategies in order until we either find a repair or run
-    out.  Process will abort if it receives an unrecognized search
-    strategies. *)
+    out, or runs a campaign of searches if one was requested. *)
 let process base ext (rep :('a,'b) Rep.representation) =
   (* load the rep, either from a cache or from source *)
   rep#load base;
@@ -114,54 +346,15 @@ let process base ext (rep :('a,'b) Rep.representation) =
       GPPopulation.deserialize ~in_channel:fin !incoming_pop_file rep
     else []
   in
-  (* Apply the requested search strategies in order. Typically there
-   * is only one, but they can be chained. *)
-  try
-    (match !search_strategy with
-     | "dist" | "distributed" | "dist-net" | "net" | "dn" ->
-       Network.distributed_client rep population
-     | "brute" | "brute_force" | "bf" ->
-       Search.brute_force_1 rep population
-     | "geom" | "geometric" ->
-       Search.geometric rep population
-     | "ww" | "ww_adaptive" | "adaptive" ->
-       Search.ww_adaptive_1 rep population
-     | "ww_prodiv" | "prodiv" | "pd-exploit" ->
-       Search.pd_exploit rep population
-     | "mjk_prodiv" | "pd" | "pd-explore" ->
-       Search.pd_explore rep population
-     | "ga" | "gp" | "genetic" ->
-       if not (GPPopulation.sanity (rep#variable_length)) then
-         abort "Incompatable representation and crossover types, aborting";
-       Search.genetic_algorithm rep population
-     | "gasga" ->
-       if not (GPPopulation.sanity (rep#variable_length)) then
-         abort "Incompatable representation and crossover types, aborting";
-       Search.gasga rep population
-     | "ssga" | "steady-state" ->
-       if not (GPPopulation.sanity (rep#variable_length)) then
-         abort "Incompatable representation and crossover types, aborting";
-       Search.steady_state_ga rep population
-     | "multiopt" | "ngsa_ii" ->
-       Multiopt.ngsa_ii rep population
-     | "mutrb" | "neut" | "neutral" ->
-       Search.neutral_variants rep
-     | "oracle" ->
-       assert(!oracle_genome <> "");
-       Search.oracle_search rep !oracle_genome;
-     | "pd-oracle" ->
-       assert(!oracle_genome <> "");
-       Search.pd_oracle_search rep !oracle_genome;
-     | "seq" ->
-       assert(!oracle_genome <> "");
-       Search.sequence rep !oracle_genome
-     | "walk" | "neutral_walk" ->
-       Search.neutral_walk rep population
-     | x -> abort "unrecognized search strategy: %s\n" x);
-    (* If we had found a repair, we could have noted it earlier and
-     * thrown an exception. *)
-    debug "\nNo repair found.\n"
-  with Search.Found_repair(rep) -> ()
+  if !campaign_seeds <> "" || !campaign_configs <> "" then
+    campaign rep population
+  else
+    try
+      search rep population ;
+      (* If we had found a repair, we could have noted it earlier and
+       * thrown an exception. *)
+      debug "\nNo repair found.\n"
+    with Search.Found_repair(rep) -> ()
 
 (***********************************************************************
  * Main driver; primary argument parsing and some debug output
@@ -252,20 +445,22 @@ let main () = begin
   (* Bookkeeping information to print out whenever we're done ... *)
   Sys.catch_break true ;
   at_exit (fun () ->
-      let tc = (Rep.num_test_evals_ignore_cache ()) in
-      debug "\nVariant Test Case Queries: %d\n" tc ;
-      debug "\"Test Suite Evaluations\": %g\n\n"
-        ((float tc) /. (float (!pos_tests + !neg_tests))) ;
-
-      debug "Compile Failures: %d\n" !Rep.compile_failures ;
-      debug "Wall-Clock Seconds Elapsed: %g\n"
-        ((Unix.gettimeofday ()) -. time_at_start) ;
-      if not !gui then
-        Stats2.print !debug_out "Program Repair Prototype (v2)" ;
-      close_out !debug_out ;
-      debug_out := stdout ;
-      if not !gui then
-        Stats2.print stdout "Program Repair Prototype (v2)" ;
+      if not !in_worker then begin
+        let tc = (Rep.num_test_evals_ignore_cache ()) in
+        debug "\nVariant Test Case Queries: %d\n" tc ;
+        debug "\"Test Suite Evaluations\": %g\n\n"
+          ((float tc) /. (float (!pos_tests + !neg_tests))) ;
+
+        debug "Compile Failures: %d\n" !Rep.compile_failures ;
+        debug "Wall-Clock Seconds Elapsed: %g\n"
+          ((Unix.gettimeofday ()) -. time_at_start) ;
+        if not !gui then
+          Stats2.print !debug_out "Program Repair Prototype (v2)" ;
+        close_out !debug_out ;
+        debug_out := stdout ;
+        if not !gui then
+          Stats2.print stdout "Program Repair Prototype (v2)" ;
+      end
     ) ;
 
   Random.init !random_seed ;
@@ -273,8 +468,10 @@ let main () = begin
   if not !Rep.no_test_cache then begin
     Rep.test_cache_load () ;
     at_exit (fun () ->
-        debug "Rep: saving test cache\n" ;
-        Rep.test_cache_save ()
+        if not !in_worker then begin
+          debug "Rep: saving test cache\n" ;
+          Rep.test_cache_save ()
+        end
       )
   end ;
 
@@ -191,7 +191,7 @@ and ngsa_ii_internal
   let ngsa_ii_sort pop = begin
     let _ =
       debug "multiopt: beginning sort\n" ;
-      Gc.compact()
+      gc_tune ()
     in
 
     let f_max = Hashtbl.create 255 in
@@ -179,20 +179,19 @@ struct
   let compare_fitness (i : ('a,'b) individual) (i' : ('a,'b) individual) =
     compare (get_opt (i#fitness ())) (get_opt (i'#fitness ()))
 
-  (** [one_tournament compare_func population] conducts a single tournament to
-      select a variant from the population. The [compare_func] should take two
-      inviduals and return a positive number if the first is preferred, a
-      negative number if the second is preferred, and 0 if neither is preferred.
-  *)
-  let one_tournament ?(compare_func=compare_fitness) (population : ('a,'b) t) =
+  (** [tournament_from compare_func sample] conducts a single tournament, as
+      [one_tournament] does, among individuals drawn by [sample]. [sample k]
+      should return [k] distinct individuals chosen at random from the
+      population (or all of them, if there are fewer than [k]). This allows
+      populations that are not stored as lists to be sampled cheaply. *)
+  let tournament_from ?(compare_func=compare_fitness) sample =
     assert ( !tournament_k >= 1 ) ;
     assert ( 0.0 <= !tournament_p ) ;
     assert ( !tournament_p <= 1.0 ) ;
-    assert ( List.length population > 0 ) ;
 
     let rec select_one () =
       (* choose k individuals at random *)
-      let pool = first_nth (random_order population) !tournament_k in
+      let pool = sample !tournament_k in
       (* sort them from most fit to least *)
       let sorted = lrev (List.sort compare_func pool) in
       (* select one with geometrically decreasing probability *)
@@ -206,6 +205,16 @@ struct
     in
     select_one ()
 
+  (** [one_tournament compare_func population] conducts a single tournament to
+      select a variant from the population. The [compare_func] should take two
+      inviduals and return a positive number if the first is preferred, a
+      negative number if the second is preferred, and 0 if neither is preferred.
+  *)
+  let one_tournament ?(compare_func=compare_fitness) (population : ('a,'b) t) =
+    assert ( List.length population > 0 ) ;
+    tournament_from ~compare_func
+      (fun k -> first_nth (random_order population) k)
+
   (** {b tournament_selection} variant_comparison_function population
       desired_pop_size uses tournament selction to select desired_pop_size
       variants from population using variant_comparison_function to compare
@@ -239,9 +248,9 @@ struct
      the point of refactoring is to decouple the evolutionary behavior from the
      representation.  I'm still thinking about it *)
   (* this can fail if the edit histories contain unexpected elements, such as
-     crossover, or if load_genome_from_string fails (which is likely, since it's
-     not implemented across the board, which is why I'm mentioning it in this
-     comment) *)
+     crossover. The children are built by applying the parents' edits directly
+     rather than by printing and reparsing them, so this works with any
+     representation that implements the four basic edits. *)
   let crossover_patch_old_behavior ?(test = 0)
       (original :('a,'b) Rep.representation)
       (variant1 :('a,'b) Rep.representation)
@@ -251,38 +260,33 @@ struct
     let h2 = variant2#get_history () in
     let wp = lmap fst (variant1#get_faulty_atoms ()) in
     let point = if test=0 then Random.int (llen wp) else test in
-    let first_half,second_half = split_nth wp point in
+    let first_half,_ = split_nth wp point in
+    let first_half =
+      lfoldl (fun set num -> AtomSet.add num set) AtomSet.empty first_half
+    in
     let c_one = original#copy () in
     let c_two = original#copy () in
-    let h11, h12 =
-      List.partition
-        (fun edit ->
-           match edit with
-           | Delete(num)
-           | Append(num, _)
-           | Swap(num,_)
-           | Replace(num,_) -> List.mem num first_half
-           | _ ->
-             abort "unexpected edit in history in patch_old_behavior crossover")
-        h1
+    let in_first_half edit =
+      match edit with
+      | Delete(num) | Append(num, _)
+      | Swap(num,_) | Replace(num,_)  ->
+        AtomSet.mem num first_half
+      | _ ->
+        abort "unexpected edit in history in patch_old_behavior crossover"
     in
-    let h21, h22 =
-      List.partition
-        (fun edit ->
-           match edit with
-           | Delete(num) | Append(num, _)
-           | Swap(num,_) | Replace(num,_)  ->
-             List.mem num first_half
-           | _ ->
-             abort "unexpected edit in history in patch_old_behavior crossover")
-        h2
+    let h11, h12 = List.partition in_first_half h1 in
+    let h21, h22 = List.partition in_first_half h2 in
+    let apply child edit =
+      match edit with
+      | Delete(num) -> child#delete num
+      | Append(num, src) -> child#append num src
+      | Swap(num, src) -> child#swap num src
+      | Replace(num, src) -> child#replace num src
+      | _ ->
+        abort "unexpected edit in history in patch_old_behavior crossover"
     in
-    let new_h1 = lmap (c_one#history_element_to_str) (h11 @ h22) in
-    let new_h2 = lmap (c_two#history_element_to_str) (h21 @ h12) in
-    let new_h1 = lfoldl (fun acc str -> acc^str^" ") "" new_h1 in
-    let new_h2 = lfoldl (fun acc str -> acc^str^" ") "" new_h2 in
-    c_one#load_genome_from_string new_h1 ;
-    c_two#load_genome_from_string new_h2 ;
+    liter (apply c_one) (h11 @ h22) ;
+    liter (apply c_two) (h21 @ h12) ;
     [ c_one ; c_two ]
 
   (* Patch Subset Crossover; works on all representations even though it was
@@ -294,18 +298,28 @@ struct
     : (('a,'b) representation) list =
     let g1 = variant1#get_genome () in
     let g2 = variant2#get_genome () in
-    let new_g1 = List.fold_left (fun acc elt ->
-        if probability !crossp then acc @ [elt] else acc
-      ) [] (g1 @ g2) in
-    let new_g2 = List.fold_left (fun acc elt ->
-        if probability !crossp then acc @ [elt] else acc
-      ) [] (g2 @ g1) in
+    let subset genes =
+      lrev (lfoldl (fun acc elt ->
+          if probability !crossp then elt :: acc else acc
+        ) [] genes)
+    in
+    let new_g1 = subset (g1 @ g2) in
+    let new_g2 = subset (g2 @ g1) in
     let c_one = original#copy () in
     let c_two = original#copy () in
     c_one#set_genome new_g1 ;
     c_two#set_genome new_g2 ;
     [ c_one ; c_two ]
 
+  (** [splice g1 p1 g2 p2] is the genome made of the first [p1] genes of [g1]
+      followed by the genes of [g2] from position [p2] on. Out-of-range points
+      are clamped, as with [split_nth]. *)
+  let splice g1 p1 g2 p2 =
+    let clamp g p = max 0 (min p (Array.length g)) in
+    let p1, p2 = clamp g1 p1, clamp g2 p2 in
+    Array.to_list
+      (Array.append (Array.sub g1 0 p1) (Array.sub g2 p2 (Array.length g2 - p2)))
+
   (* One point crossover *)
   let crossover_one_point ?(test = 0)
       (original :('a,'b) Rep.representation)
@@ -325,22 +339,27 @@ struct
         let legal2,interfun2 = variant2#available_crossover_points () in
         let legal1' = interfun1 legal1 legal2 in
         let legal2' = interfun2 legal2 legal1 in
+        let pick legal =
+          match legal with
+          | [] -> failwith "crossover_one_point: no legal crossover points"
+          | _ -> List.nth legal (Random.int (llen legal))
+        in
         (* if variants are of stable length, we only need to choose one
            point *)
         if not variant1#variable_length then
-          let rand = List.hd (random_order legal1') in
+          let rand = pick legal1' in
           rand,rand
         else
-          let rand1 = List.hd (random_order legal1') in
-          let rand2 = List.hd (random_order legal2') in
+          let rand1 = pick legal1' in
+          let rand2 = pick legal2' in
           rand1,rand2
     in
-    let g1a,g1b = split_nth (variant1#get_genome()) point1 in
-    let g2a,g2b = split_nth (variant2#get_genome()) point2 in
-    child1#set_genome (g1a@g2b);
+    let g1 = Array.of_list (variant1#get_genome()) in
+    let g2 = Array.of_list (variant2#get_genome()) in
+    child1#set_genome (splice g1 point1 g2 point2);
     (* do we care that the history info is destroyed for patch representation
        here? *)
-    child2#set_genome (g2a@g1b);
+    child2#set_genome (splice g2 point2 g1 point1);
     [child1;child2]
 
   (** do_cross original variant1 variant2 performs crossover on variant1 and
@@ -370,14 +389,14 @@ struct
       population, returning a new population with both the old and the new
       variants *)
   let crossover population original =
-    let mating_list = random_order population in
+    let mating_list = Array.of_list (random_order population) in
     (* should we cross an individual? *)
     let maybe_cross () = Random.float 1.0 <= !crossp in
     let output = ref [] in
-    let half = (List.length mating_list) / 2 in
+    let half = (Array.length mating_list) / 2 in
     for it = 0 to (half - 1) do
-      let parent1 = List.nth mating_list it in
-      let parent2 = List.nth mating_list (half + it) in
+      let parent1 = mating_list.(it) in
+      let parent2 = mating_list.(half + it) in
       if maybe_cross () then
         output := (do_cross original parent1 parent2) @ !output
       else
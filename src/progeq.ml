@@ -522,6 +522,17 @@ let rec partition_block files block edit_effects
 
 let alias_computed = ref false
 
+(* Runs the alias analysis on all of the files, once. Later queries (such as
+ * Ptranal.resolve_funptr) refer to its results. *)
+let compute_aliases files =
+  if not !alias_computed then begin
+    Ptranal.conservative_undefineds := true ;
+    (* Ptranal.no_sub := true ; *)
+    debug "progeq: computing alias analysis information\n" ;
+    StringMap.iter (fun x f -> Ptranal.analyze_file f) files ;
+    alias_computed := true
+  end
+
 (* Given an edit, partition the entire program (all the files) into
  * equivalence classes with respect to that edit.
  *
@@ -529,13 +540,7 @@ let alias_computed = ref false
  * call 'partition' once per edit to access our services.
 *)
 let partition files edit_effects =
-  if not !alias_computed then begin
-    Ptranal.conservative_undefineds := true ;
-    (* Ptranal.no_sub := true ; *)
-    debug "progeq: computing alias analysis information\n" ;
-    StringMap.iter (fun x f -> Ptranal.analyze_file f) files ;
-    alias_computed := true
-  end ;
+  compute_aliases files ;
   let partitions = ref [] in
   StringMap.iter (fun x file ->
       iterGlobals file (fun glob ->
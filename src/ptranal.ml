@@ -77,6 +77,7 @@ let debug = A.debug
 let analyze_mono = A.analyze_mono
 let no_flow = A.no_flow
 let no_sub = A.no_sub
+let collapse_cycles = A.collapse_cycles
 let fun_ptrs_as_funs = ref false
 let show_progress = ref false
 let debug_may_aliases = ref false
@@ -64,7 +64,7 @@ type test =
 type test_metrics = {
   pass_count : float ;
   fail_count : float ;
-  cost : float ; (* "cost" of test, e.g., runtime in seconds *)
+  cost : float ; (* "cost" of test: CPU seconds used by the test command *)
 }
 
 module OrderedTest =
@@ -110,6 +110,29 @@ let atoms_visited_by_edit_history eh =
       )
     ) (AtomSet.empty) eh
 
+(** [variant_identity] is the incrementally maintained identity of a variant:
+    the descriptive strings of its edits, most recent first, and a 64-bit
+    FNV-style hash over them.  The full name is only rendered on demand and then
+    remembered in [id_name]; identities are otherwise never modified, so copies
+    of a variant can share them. *)
+type variant_identity = {
+  id_parts : string list ;
+  id_hash : Int64.t ;
+  mutable id_name : string option ;
+}
+
+let empty_identity () =
+  { id_parts = [] ; id_hash = 0xcbf29ce484222325L ; id_name = None }
+
+(** @param ident identity of a variant
+    @param part descriptive string of one more edit
+    @return the identity of the variant with the edit appended *)
+let extend_identity ident part =
+  let h = Int64.logxor ident.id_hash (Int64.of_int (Hashtbl.hash part)) in
+  { id_parts = part :: ident.id_parts ;
+    id_hash  = Int64.mul h 0x100000001b3L ;
+    id_name  = None }
+
 (** [mutation] and [mutation_id] are used to describe what atom-level
     mutations are permitted in a given representation type *)
 
@@ -414,6 +437,11 @@ class type ['gene,'code] representation = object('self_type)
       @param atom_id to delete.  *)
   method delete : atom_id -> unit
 
+  (** @param faulty_atom query atom
+      @return false if deleting [faulty_atom] is known to leave the program
+      unchanged *)
+  method can_delete : atom_id -> bool
+
   (** modifies this variant by appending [what_to_append] after [after_what]
 
       @param after_what where to append
@@ -486,7 +514,8 @@ class type ['gene,'code] representation = object('self_type)
   method atom_to_str : 'code -> string
 
   (** Equal variants must have equal hash codes, but equivalent variants need
-      not. By default, this is a hash of the history.
+      not. By default, this is the incrementally maintained hash of the names
+      of the edits in the history.
 
       @return hashvalue for this variant.*)
   method hash : unit -> int
@@ -537,6 +566,7 @@ let use_subdirs = ref false
 let port = ref 808
 let no_test_cache = ref false
 let name_in_test_cache = ref false
+let test_metrics_decay = ref 1.0
 let no_rep_cache = ref false
 let num_fitness_samples = ref 1
 let allow_coverage_fail = ref false
@@ -581,6 +611,9 @@ let ccfile = ref ""  (* path to code clone file *)
 
 let disable_aslr = ref false
 
+let test_manifest = ref ""
+let binary_cache = ref false
+
 let _ =
   options := !options @
              [
@@ -596,6 +629,13 @@ let _ =
                "--name-in-test-cache", Arg.Set name_in_test_cache,
                " cache variant names with test results. Default: unset to same memory";
 
+               "--test-metrics-decay",
+               Arg.Float (fun x ->
+                   if x <= 0.0 || x > 1.0 then
+                     raise (Arg.Bad "--test-metrics-decay: X must be in (0,1]")
+                   else test_metrics_decay := x),
+               "X scale old test pass/fail counts by X (0 < X <= 1) on each new result. Default: 1.0 (no decay)";
+
                "--neg-weight", Arg.Set_float negative_path_weight,
                "X weight to give statements only on the negative path. Default: 1.0";
 
@@ -615,6 +655,12 @@ let _ =
 
                "--test-script", Arg.Set_string test_script, "X use X as test script name";
 
+               "--binary-cache", Arg.Set binary_cache,
+               " share test results between variants that build to the same executable";
+
+               "--test-manifest", Arg.Set_string test_manifest,
+               "X run the tests listed in manifest X directly, without the test command";
+
                "--compiler", Arg.Set_string compiler_name, "X use X as compiler";
 
                "--compiler-command", Arg.Set_string compiler_command,
@@ -857,7 +903,20 @@ let test_cache_query digest test =
     Stats2.time "test_cache hit" (fun () -> Some(res)) ()
   with Not_found ->
     nht_cache_query digest test
+
+(* When [test_cache_journal] is [Some(digests)], [test_cache_add] records the
+   digests of the variants it adds results for. A worker process (see
+   [Global.fork_worker]) uses this to send its new results back to its parent
+   with [test_cache_export] and [test_cache_merge]. *)
+let test_cache_journal = ref None
+
+let test_cache_note digest =
+  match !test_cache_journal with
+  | Some(digests) -> test_cache_journal := Some(digest :: digests)
+  | None -> ()
+
 let test_cache_add digest name test result =
+  test_cache_note digest ;
   let name, second_ht =
     try Hashtbl.find !test_cache digest with _ -> name, Hashtbl.create 7
   in
@@ -879,16 +938,159 @@ let test_cache_add digest name test result =
   else
     Hashtbl.replace !test_cache digest ("", second_ht);
   nht_cache_add digest test value
+
+(* With [--binary-cache], variants whose executables are the same share their
+   test results, whatever their source: [binary_variants] maps the digest of
+   each executable built so far to the digest of the first variant that
+   produced it. *)
+let binary_variants = Hashtbl.create 255
+
+(** @return the digest of the sections of an ELF executable that are loaded
+    when it runs, other than its build-id, so that executables that differ
+    only in symbol tables, debugging information (which name the source file)
+    or build-id digest the same; [None] if [exe_name] is not a little-endian
+    ELF file *)
+let binary_digest exe_name =
+  try
+    let fin = open_in_bin exe_name in
+    let s = really_input_string fin (in_channel_length fin) in
+    close_in fin ;
+    if String.length s < 64 || String.sub s 0 4 <> "\127ELF"
+       || s.[5] <> '\001' then None
+    else begin
+      let is64 = s.[4] = '\002' in
+      let int_at i n =
+        let r = ref 0 in
+        for k = n - 1 downto 0 do
+          r := (!r lsl 8) lor (Char.code s.[i + k])
+        done ;
+        !r
+      in
+      let shoff = if is64 then int_at 0x28 8 else int_at 0x20 4 in
+      let shentsize = int_at (if is64 then 0x3a else 0x2e) 2 in
+      let shnum = int_at (if is64 then 0x3c else 0x30) 2 in
+      let shstrndx = int_at (if is64 then 0x3e else 0x32) 2 in
+      (* name, type, flags, offset and size of section k *)
+      let section k =
+        let h = shoff + k * shentsize in
+        if is64 then
+          int_at h 4, int_at (h + 4) 4, int_at (h + 0x08) 8,
+          int_at (h + 0x18) 8, int_at (h + 0x20) 8
+        else
+          int_at h 4, int_at (h + 4) 4, int_at (h + 0x08) 4,
+          int_at (h + 0x10) 4, int_at (h + 0x14) 4
+      in
+      let _, _, _, names, _ = section shstrndx in
+      let name_at i =
+        String.sub s (names + i) (String.index_from s (names + i) '\000' - names - i)
+      in
+      let loaded = Buffer.create (String.length s) in
+      for k = 0 to shnum - 1 do
+        let name, typ, flags, offset, size = section k in
+        let name = name_at name in
+        let shf_alloc = 2 and sht_nobits = 8 in
+        if flags land shf_alloc <> 0 && name <> ".note.gnu.build-id" then begin
+          Buffer.add_string loaded name ;
+          Buffer.add_char loaded '\000' ;
+          if typ = sht_nobits then Buffer.add_string loaded (string_of_int size)
+          else Buffer.add_string loaded (String.sub s offset size)
+        end
+      done ;
+      Some(Digest.string (Buffer.contents loaded))
+    end
+  with _ -> None
+
+(** records that the variant with the given [digest] was built as [exe_name].
+    If an earlier variant was built to the same executable, the two now share
+    one set of test results. *)
+let test_cache_share_binary digest exe_name =
+  match binary_digest exe_name with
+  | None -> ()
+  | Some(binary) when Hashtbl.mem binary_variants binary ->
+    let first = Hashtbl.find binary_variants binary in
+    if first <> digest then begin
+      let shared =
+        ht_find !test_cache first (fun () -> "", Hashtbl.create 7) in
+      (try
+         hiter (fun test result ->
+             if not (Hashtbl.mem (snd shared) test) then
+               Hashtbl.replace (snd shared) test result
+           ) (snd (Hashtbl.find !test_cache digest))
+       with Not_found -> ()) ;
+      Hashtbl.replace !test_cache digest shared ;
+      test_cache_note first ;
+      test_cache_note digest
+    end
+  | Some(binary) -> Hashtbl.replace binary_variants binary digest
+
+(** @return the test cache entries for every variant recorded in
+    [test_cache_journal] *)
+let test_cache_export () =
+  match !test_cache_journal with
+  | None -> []
+  | Some(digests) ->
+    lfoldl (fun entries digest ->
+        if List.mem_assoc digest entries then entries
+        else (digest, Hashtbl.find !test_cache digest) :: entries
+      ) [] digests
+
+(** adds entries from [test_cache_export] in another process to this test
+    cache. For each test, the entry with more fitness samples wins. *)
+let test_cache_merge entries =
+  liter (fun (digest, (name, second_ht)) ->
+      let name, mine =
+        try Hashtbl.find !test_cache digest with Not_found -> name, Hashtbl.create 7
+      in
+      hiter (fun test (passed, fitness) ->
+          let have =
+            try llen (snd (Hashtbl.find mine test)) with Not_found -> -1 in
+          if have < llen fitness then
+            Hashtbl.replace mine test (passed, fitness)
+        ) second_ht ;
+      Hashtbl.replace !test_cache digest (name, mine)
+    ) entries
+
 let test_cache_version = 9
+
+(* The test metrics (see [test_metrics_table]) are saved next to the test cache
+   so that test prioritization starts warm. They include runs that were never
+   cached, as well as costs, so they replace the counts rebuilt from the cache
+   when they are available. *)
+let test_metrics_version = 2
+let test_metrics_save () =
+  let fout = open_out_bin "repair.metrics" in
+  Marshal.to_channel fout test_metrics_version [] ;
+  Marshal.to_channel fout test_metrics_table [] ;
+  close_out fout
+
+let test_metrics_load () =
+  try
+    let fin = open_in_bin "repair.metrics" in
+    let v = Marshal.from_channel fin in
+    if v <> test_metrics_version then begin
+      debug "repair.metrics: file format %d expected, %d found (skipping)\n"
+        test_metrics_version v ;
+      close_in fin ;
+      raise Not_found
+    end ;
+    let saved = Marshal.from_channel fin in
+    close_in fin ;
+    Hashtbl.reset test_metrics_table ;
+    hiter (hrep test_metrics_table) saved ;
+    debug "repair.metrics: loaded metrics for %d tests\n"
+      (Hashtbl.length test_metrics_table)
+  with _ -> ()
+
 let test_cache_save () =
   let fout = open_out_bin "repair.cache" in
   Marshal.to_channel fout test_cache_version [] ;
   Marshal.to_channel fout !name_in_test_cache [] ;
   Marshal.to_channel fout (!test_cache) [] ;
-  close_out fout
+  close_out fout ;
+  test_metrics_save ()
 
 let test_cache_load () =
-  try
+  begin try
     let fout = open_in_bin "repair.cache" in
     let v = Marshal.from_channel fout in
     if v <> test_cache_version then begin
@@ -916,7 +1118,8 @@ let test_cache_load () =
                 {old with fail_count = old.fail_count +. 1.}) second_ht)
       !test_cache ;
     close_in fout
-  with _ -> ()
+  with _ -> () end ;
+  test_metrics_load ()
 
 (* Jon Dorn has made the argument that this function (human_readable_cache_save) should exist in its
    own module. However, there does not exist a module currently that has a function similar to this
@@ -949,11 +1152,228 @@ let human_readable_cache_save filename =
 
 let tested = ref 0
 
+(** {b Test manifests} With [--test-manifest], each test listed in the
+    manifest is run by executing the program under test directly, with no
+    shell or test script. Each line of the manifest gives the test name (e.g.,
+    [p1]), the expected exit status, a timeout in seconds (0 for none), a file
+    to use as standard input and a file holding the expected standard output
+    (either may be "-"), and then the arguments to the program:
+
+    [p1 0 5 tests/1.in tests/1.out 1071 1029]
+
+    The output is compared with the expected output as it is produced, and the
+    program is killed at the first difference or when its time runs out. *)
+type manifest_test = {
+  exit_code : int ;
+  timeout : float ;
+  stdin_file : string option ;
+  expected_file : string option ;
+  arguments : string list ;
+}
+
+let manifest_tests = Hashtbl.create 255
+
+(* a --single-fitness test reports its value in a file that only the test
+   script writes, so it is always run through the script *)
+let manifest_entry test =
+  if !test_manifest = "" || test = Single_Fitness then None
+  else begin
+    if Hashtbl.length manifest_tests = 0 then
+      liter (fun line ->
+          let file f = if f = "-" then None else Some(f) in
+          match Str.split space_regexp line with
+          | name :: code :: timeout :: input :: expected :: args ->
+            Hashtbl.replace manifest_tests (test_of_string name)
+              { exit_code = int_of_string code ;
+                timeout = float_of_string timeout ;
+                stdin_file = file input ;
+                expected_file = file expected ;
+                arguments = args }
+          | _ -> abort "%s: malformed test: %s\n" !test_manifest line
+        ) (lfilt (fun line -> line <> "" && line.[0] <> '#')
+             (get_lines !test_manifest)) ;
+    try Some(Hashtbl.find manifest_tests test) with Not_found -> None
+  end
+
+(** the machine name passed to setarch by --disable-aslr *)
+let aslr_arch = lazy (read_process "uname -m")
+
+(* a manifest test in progress *)
+type manifest_run = {
+  child : int ;
+  output : Unix.file_descr ;
+  expected : in_channel option ;
+  deadline : float ;
+  wanted : int ;
+  mutable passing : bool ;
+  mutable reading : bool ;
+  mutable status : Unix.process_status option ;
+}
+
+(** runs each [(exe_name, manifest_test)] of [jobs] at once.
+
+    @return for each job, in order, whether the test passed and the CPU time
+    (user plus system) it used *)
+let manifest_run jobs =
+  let buffer = Bytes.create 4096 in
+  let expected_buffer = Bytes.create 4096 in
+  let start (exe_name, t) =
+    let open_file name flag =
+      try Unix.openfile name [flag] 0
+      with Unix.Unix_error(e,_,_) ->
+        abort "%s: cannot open %s: %s\n" !test_manifest name
+          (Unix.error_message e)
+    in
+    let input =
+      match t.stdin_file with
+      | Some(name) -> open_file name Unix.O_RDONLY
+      | None -> open_file "/dev/null" Unix.O_RDONLY
+    in
+    let null = open_file "/dev/null" Unix.O_WRONLY in
+    let output, child_output = Unix.pipe () in
+    Unix.set_close_on_exec output ;
+    let prog, args =
+      if !disable_aslr then
+        "setarch", (Lazy.force aslr_arch) :: "-R" :: exe_name :: t.arguments
+      else exe_name, t.arguments
+    in
+    let child =
+      Unix.create_process prog (Array.of_list (prog :: args))
+        input child_output null
+    in
+    liter Unix.close [input; child_output; null] ;
+    { child = child ;
+      output = output ;
+      expected =
+        (match t.expected_file with
+         | Some(name) -> Some(open_in_bin name)
+         | None -> None) ;
+      deadline =
+        if t.timeout > 0.0 then Unix.gettimeofday () +. t.timeout
+        else infinity ;
+      wanted = t.exit_code ;
+      passing = true ;
+      reading = true ;
+      status = None }
+  in
+  let stop_reading run =
+    run.reading <- false ;
+    Unix.close run.output ;
+    match run.expected with
+    | Some(chan) -> close_in chan
+    | None -> ()
+  in
+  let fail run =
+    run.passing <- false ;
+    if run.reading then stop_reading run ;
+    (try Unix.kill run.child Sys.sigkill with _ -> ())
+  in
+  (* compares the next piece of output with the expected output *)
+  let read_some run =
+    let n = Unix.read run.output buffer 0 (Bytes.length buffer) in
+    match run.expected with
+    | Some(chan) when n = 0 ->
+      (try ignore (input_char chan) ; run.passing <- false
+       with End_of_file -> ()) ;
+      stop_reading run
+    | Some(chan) ->
+      (try
+         really_input chan expected_buffer 0 n ;
+         if Bytes.sub buffer 0 n <> Bytes.sub expected_buffer 0 n then
+           fail run
+       with End_of_file -> fail run)
+    | None -> if n = 0 then stop_reading run
+  in
+  let cpu = Hashtbl.create 7 in
+  let rec reap flags run =
+    let before = Stats2.child_cpu_time () in
+    match Unix.waitpid flags run.child with
+    | exception Unix.Unix_error(Unix.EINTR,_,_) -> reap flags run
+    | 0, _ -> ()
+    | _, status ->
+      let used = Stats2.child_cpu_time () -. before in
+      Stats2.note_child "test" used ;
+      hrep cpu run.child used ;
+      run.status <- Some(status)
+  in
+  (* A SIGCHLD handler writes to [wake] so that select also returns when a
+     test exits after closing its output. If the signal arrives before select
+     blocks, the byte is already waiting, so no exit can be missed. *)
+  let wake, wake_writer = Unix.pipe () in
+  liter (fun fd -> Unix.set_nonblock fd ; Unix.set_close_on_exec fd)
+    [wake; wake_writer] ;
+  let old_sigchld =
+    Sys.signal Sys.sigchld (Sys.Signal_handle (fun _ ->
+        try ignore (Unix.single_write wake_writer (Bytes.make 1 'x') 0 1)
+        with _ -> ()))
+  in
+  let drain () =
+    try
+      while Unix.read wake buffer 0 (Bytes.length buffer) > 0 do () done
+    with Unix.Unix_error _ -> ()
+  in
+  let runs = lmap start jobs in
+  let rec loop () =
+    let running = lfilt (fun run -> run.status = None) runs in
+    if running <> [] then begin
+      let reading = lfilt (fun run -> run.reading) running in
+      let deadline =
+        lfoldl (fun d run -> min d run.deadline) infinity running in
+      let timeout =
+        if deadline = infinity then -1.0
+        else max 0.0 (deadline -. Unix.gettimeofday ())
+      in
+      let ready, _, _ =
+        try
+          Unix.select (wake :: lmap (fun run -> run.output) reading)
+            [] [] timeout
+        with Unix.Unix_error(Unix.EINTR,_,_) -> [], [], []
+      in
+      if List.mem wake ready then drain () ;
+      liter (fun run -> if List.mem run.output ready then read_some run) reading ;
+      let now = Unix.gettimeofday () in
+      liter (fun run ->
+          if not run.reading then reap [Unix.WNOHANG] run ;
+          if run.status = None && now >= run.deadline then begin
+            fail run ;
+            reap [] run
+          end
+        ) running ;
+      loop ()
+    end
+  in
+  let restore () =
+    Sys.set_signal Sys.sigchld old_sigchld ;
+    liter Unix.close [wake; wake_writer]
+  in
+  (try loop () with e -> restore () ; raise e) ;
+  restore () ;
+  lmap (fun run ->
+      (run.passing && run.status = Some(Unix.WEXITED(run.wanted))),
+      hfind cpu run.child
+    ) runs
+
 (** num_test_evals_ignore_cache () provides the number of test
     evaluations we've had to do on this run, whether they were cached
     or not.  *)
 let num_test_evals_ignore_cache () =  !tested
 
+(** counts [n] test evaluations done on our behalf by a worker process *)
+let add_test_evals n = tested := !tested + n
+
+(** @return the test metrics that changed since [before], a copy of
+    [test_metrics_table] *)
+let test_metrics_export before =
+  Hashtbl.fold (fun test m changed ->
+      if (try Hashtbl.find before test <> m with Not_found -> true) then
+        (test, m) :: changed
+      else changed
+    ) test_metrics_table []
+
+(** adds the metrics from [test_metrics_export] in another process *)
+let test_metrics_merge changed =
+  liter (fun (test, m) -> Hashtbl.replace test_metrics_table test m) changed
+
 (**/**)
 let compile_failures = ref 0
 let test_counter = ref 0
@@ -1022,9 +1442,13 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
   (** ".exe" filename on disk *)
   val mutable already_compiled = ref None
 
-  (** history is a list of edit operations performed to acheive this variant *)
+  (** history is a list of edit operations performed to acheive this variant,
+      most recent first so that adding an edit takes constant time *)
   val mutable history = ref []
 
+  (** the name and hash of this variant, maintained alongside [history] *)
+  val mutable identity = ref (empty_identity ())
+
   (** failed_sanity_tests tracks tests that failed during the sanity check when
       --skip-failed-sanity-tests is set. This is distinct from [skipped_tests]
       since the user may change that from run to run on the command line, but
@@ -1076,6 +1500,7 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
     already_digest         <- ref !already_digest ;
     already_compiled       <- ref !already_compiled ;
     history                <- ref !history ;
+    identity               <- ref !identity ;
     other
 
   (***********************************)
@@ -1255,7 +1680,7 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
   method system_aslr cmd =
 	let local_cmd = 
 	if not !disable_aslr then cmd
-	else "setarch "^(read_process "uname -m")^" -R "^(cmd) in
+	else "setarch "^(Lazy.force aslr_arch)^" -R "^(cmd) in
     system local_cmd;
     
 
@@ -1305,16 +1730,23 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
     with Not_found -> None
 
   method compile source_name exe_name =
+    self#internal_compile source_name source_name exe_name
+
+  (** compiles [inputs] (which may name several source and object files) into
+      [exe_name], but records [source_name] as the source of this variant,
+      which is what tests are later given as [__SOURCE_NAME__] *)
+  method private internal_compile source_name inputs exe_name =
     let base_command = self#get_compiler_command () in
     let cmd = Global.replace_in_string base_command
         [
           "__COMPILER_NAME__", !compiler_name ;
           "__EXE_NAME__", exe_name ;
-          "__SOURCE_NAME__", source_name ;
+          "__SOURCE_NAME__", inputs ;
           "__COMPILER_OPTIONS__", !compiler_options ;
         ]
     in
-    let result = (match Stats2.time "compile" system cmd with
+    let status, _ = Stats2.time "compile" (system_cpu "compile") cmd in
+    let result = (match status with
         | Unix.WEXITED(0) ->
           already_compiled := Some(exe_name,source_name) ;
           true
@@ -1410,8 +1842,14 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
       let wait_for_count = ref 0 in
       let result_ht = Hashtbl.create 255 in
       let pid_to_test_ht = Hashtbl.create 255 in
+      let manifest_jobs = ref [] in
       List.iter (fun (test,prep) ->
           match prep with
+          | Must_Run_Test(digest,exe_name,_,_)
+            when manifest_entry test <> None ->
+            manifest_jobs :=
+              (test, digest, exe_name, get_opt (manifest_entry test))
+              :: !manifest_jobs
           | Must_Run_Test(digest,exe_name,source_name,_) ->
             incr wait_for_count ;
             let cmd, fitness_file =
@@ -1419,22 +1857,40 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
             let p = Stats2.time "test" (fun () ->
                 popen ~stdout:(UseDescr(dev_null)) ~stderr:(UseDescr(dev_null))
                   "/bin/bash" ["-c"; cmd]) () in
-            Hashtbl.replace
-              pid_to_test_ht p.pid (test,(Unix.gettimeofday()),fitness_file,digest)
+            Hashtbl.replace pid_to_test_ht p.pid (test,fitness_file,digest)
 
           | Have_Test_Result(digest,result) ->
             Hashtbl.replace result_ht test (digest,result)
         ) todo ;
+      (* manifest tests run while the scripted ones do *)
+      let manifest_results =
+        Stats2.time "test" manifest_run
+          (lmap (fun (_,_,exe_name,t) -> exe_name, t) !manifest_jobs) in
+      List.iter2 (fun (test,digest_list,exe_name,_) (passed,cpu) ->
+          let status = if passed then Unix.WEXITED(0) else Unix.WEXITED(1) in
+          let result =
+            self#internal_test_case_postprocess test cpu status
+              (exe_name ^ ".fitness") in
+          test_cache_add digest_list (self#name()) test result ;
+          Hashtbl.replace result_ht test
+            (digest_list, get_opt (self#internal_check_test_cache test))
+        ) !manifest_jobs manifest_results ;
       Stats2.time "wait (for parallel tests)" (fun () ->
+          (* a test's CPU time is added to ours when it is reaped, so the
+             increase across each wait belongs to the test it reaped *)
+          let reaped = ref (Stats2.child_cpu_time ()) in
           while !wait_for_count > 0 do
             try
               match Unix.wait () with
               | pid, status ->
-                let test, start, fitness_file, digest_list =
+                let now = Stats2.child_cpu_time () in
+                let cpu = now -. !reaped in
+                reaped := now ;
+                Stats2.note_child "test" cpu ;
+                let test, fitness_file, digest_list =
                   Hashtbl.find pid_to_test_ht pid in
-                let runtime = (Unix.gettimeofday()) -. start in
                 let result =
-                  self#internal_test_case_postprocess test runtime status fitness_file in
+                  self#internal_test_case_postprocess test cpu status fitness_file in
                 decr wait_for_count ;
                 test_cache_add digest_list (self#name()) test result ;
                 Hashtbl.replace result_ht test
@@ -1458,9 +1914,22 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
     end
 
   (**/**)
-  method get_history () = !history
+  method get_history () = lrev !history
 
-  method add_history edit = history := !history @ [edit]
+  method add_history edit =
+    self#record_history edit (self#history_element_to_str edit)
+
+  (** adds [edit] to the history and [part] to the name of this variant *)
+  method private record_history edit part =
+    history := edit :: !history ;
+    identity := extend_identity !identity part
+
+  (** replaces the history with [edits], given in order and each paired with
+      its part of the name of this variant *)
+  method private reset_history edits =
+    history := [] ;
+    identity := empty_identity () ;
+    liter (fun (edit, part) -> self#record_history edit part) edits
 
   (* give a "descriptive" name for this variant. For most, the name is based on
    * the atomic mutations applied in order. Those are stored in the "history"
@@ -1484,18 +1953,26 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
       Printf.sprintf "e(%d,%d,%s)" aid sid (self#atom_to_str atom)
 
 
+  (** @param parts the names of the edits in the history, in order
+      @return the name of a variant with that (non-empty) history *)
+  method private render_name parts =
+    let b = Buffer.create 40 in
+    List.iter (fun str ->
+        if str <> "" then
+          Printf.bprintf b "%s " str
+      ) parts ;
+    Buffer.contents b
+
   method name () =
-    let history = self#get_history () in
-    if history = [] then "original"
-    else begin
-      let b = Buffer.create 40 in
-      List.iter (fun h ->
-          let str = self#history_element_to_str h in
-          if str <> "" then
-            Printf.bprintf b "%s " str
-        ) history ;
-      Buffer.contents b
-    end
+    let ident = !identity in
+    if ident.id_parts = [] then "original"
+    else
+      match ident.id_name with
+      | Some(name) -> name
+      | None ->
+        let name = self#render_name (lrev ident.id_parts) in
+        ident.id_name <- Some(name) ;
+        name
 
   (* by default, we can crossover at any point along the genome, and given
      individuals a and b (where this current object is a, we don't do any funny
@@ -1532,7 +2009,7 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
     self#updated () ;
     self#add_history (LaseTemplate(name))
 
-  method hash () = Hashtbl.hash (self#get_history ())
+  method hash () = Int64.to_int (!identity).id_hash
 
   (***********************************)
   (* Internal methods that may not be called from outside the class.  Much of
@@ -1635,12 +2112,12 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
       warning
 
       @param test the test that produced these results
-      @param runtime the duration of the test
+      @param cpu_time the CPU time (user plus system) used by the test
       @param status process status for the executed test case
       @param fitness_file on-disk file to which the test script may have written
       @return fitness array of fitnesses, floating point numbers
   *)
-  method private internal_test_case_postprocess test runtime status fitness_file =
+  method private internal_test_case_postprocess test cpu_time status fitness_file =
     let result = match status with
       | Unix.WEXITED(0) -> true
       | _ -> false
@@ -1676,16 +2153,20 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
        (* I'd rather this goes in cleanup() but it's not super-obvious how *)
        try Unix.unlink fitness_file with _ -> ());
 
-    (* update counts of passing/failing tests for test prioritization *)
+    (* update counts of passing/failing tests for test prioritization. Old
+       counts are decayed so that recent results dominate; the cost is a
+       running mean over the same (decayed) number of results. *)
     let old = self#test_metrics test in
-    let count = old.pass_count +. old.fail_count in
-    let cost = old.cost +. (runtime -. old.cost) /. (count +. 1.) in
+    let pass_count = old.pass_count *. !test_metrics_decay in
+    let fail_count = old.fail_count *. !test_metrics_decay in
+    let count = pass_count +. fail_count in
+    let cost = old.cost +. (cpu_time -. old.cost) /. (count +. 1.) in
     if result then
       Hashtbl.replace test_metrics_table test
-        {old with pass_count = old.pass_count +. 1.; cost = cost}
+        {pass_count = pass_count +. 1.; fail_count = fail_count; cost = cost}
     else
       Hashtbl.replace test_metrics_table test
-        {old with fail_count = old.fail_count +. 1.; cost = cost} ;
+        {pass_count = pass_count; fail_count = fail_count +. 1.; cost = cost} ;
 
     (* update eval_count to reflect new results *)
     let map, total = eval_count in
@@ -1710,10 +2191,15 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
     let cmd, fitness_file =
       self#internal_test_case_command exe_name source_name test in
     (* Run our single test. *)
-    let start = Unix.gettimeofday () in
-    let status = Stats2.time "test" system cmd in
-    let runtime = (Unix.gettimeofday ()) -. start in
-    self#internal_test_case_postprocess test runtime status fitness_file
+    let status, cpu_time =
+      match manifest_entry test with
+      | Some(t) ->
+        let passed, cpu_time =
+          List.hd (Stats2.time "test" manifest_run [exe_name, t]) in
+        (if passed then Unix.WEXITED(0) else Unix.WEXITED(1)), cpu_time
+      | None -> Stats2.time "test" (system_cpu "test") cmd
+    in
+    self#internal_test_case_postprocess test cpu_time status fitness_file
 
   method test_metrics test =
     ht_find test_metrics_table test (fun () ->
@@ -1765,8 +2251,13 @@ class virtual ['gene,'code] cachingRepresentation = object (self : ('gene,'code)
           if not (self#compile source_name exe_name) then begin
             test_cache_add digest_list (self#name()) test (false, [ [| 0.0 |] ]) ;
             exe_name,source_name,false
-          end else
+          end else begin
+            if !binary_cache then begin
+              test_cache_share_binary digest_list exe_name ;
+              try_cache false
+            end ;
             exe_name,source_name,true
+          end
         | Some("",source) ->
           "", source, false (* it failed to compile before *)
         | Some(exe,source) ->
@@ -2029,7 +2520,7 @@ class virtual ['gene,'code] faultlocRepresentation = object (self)
       lfilt
         (fun (mutation,prob) ->
            match mutation with
-             Delete_mut -> true
+             Delete_mut -> self#can_delete mut_id
            | Append_mut ->
              (* CLG FIXME/thought: cache the sources list? *)
              (WeightSet.cardinal (self#append_sources mut_id)) > 0
@@ -2042,7 +2533,9 @@ class virtual ['gene,'code] faultlocRepresentation = object (self)
         ) !mutations
     in
     (* Cannot cache available mutations if nested mutations are enabled; the
-       set of applicable sources may change based on previous mutations. *)
+       set of applicable sources may change based on previous mutations.
+       Representations that support nested mutation should instead cache their
+       sources per atom (see cilRep's [indexed_sources]). *)
     if !do_nested then compute_available ()
     else ht_find mutation_cache mut_id compute_available
 
@@ -2058,6 +2551,8 @@ class virtual ['gene,'code] faultlocRepresentation = object (self)
 
   method template_available_mutations str location_id =  []
 
+  method can_delete x = true
+
   method append_sources x =
     lfoldl
       (fun weightset ->
@@ -80,6 +80,8 @@ let fitness_log = ref ""
 
 let disable_reduce_fix_space = ref false
 let disable_reduce_search_space = ref false
+let sequence_workers = ref 1
+let gasga_batch = ref 1
 
 (* The "--search adaptive" strategy interprets these strings as
  * mathematical expressions. They determine the order in which edits
@@ -147,6 +149,12 @@ let _ =
 
       "--disable-reduce-search-space", Arg.Set disable_reduce_search_space,
       " Disable search (fault) space reductions.  Default: false";
+
+      "--sequence-workers", Arg.Set_int sequence_workers,
+      "X evaluate up to X genomes at once in the sequence search. Default: 1";
+
+      "--gasga-batch", Arg.Set_int gasga_batch,
+      "X generate and evaluate X children at once in gasga. Default: 1";
     ]
 
 (**/**)
@@ -157,6 +165,85 @@ exception Maximum_evals of int
 (** thrown by some search strategies when a repair is found *)
 exception Found_repair of string
 
+(** the base name of the directory and file to which [note_success] writes a
+    repair *)
+let repair_name = ref "repair"
+
+(** ranks individuals by fitness; the int is the [Oo.id] of the individual *)
+module FitnessRank = Set.Make(struct
+    type t = float * int
+    let compare = compare
+  end)
+
+(** An indexed population for [steady_state_ga]. Individuals are kept in an
+    array, in no particular order, so that a random individual can be chosen
+    or removed in constant time; [slots] maps the [Oo.id] of each individual to
+    its index. [ranked] orders them by fitness, so that the worst can be found
+    and removed in logarithmic time. Individuals must have a fitness before
+    they are added. *)
+type ('a,'b) indexed_population = {
+  mutable individuals : ('a,'b) Rep.representation array ;
+  mutable size : int ;
+  slots : (int, int) Hashtbl.t ;
+  mutable ranked : FitnessRank.t ;
+}
+
+let ipop_key (rep : ('a,'b) Rep.representation) =
+  get_opt (rep#fitness ()), Oo.id rep
+
+(* an individual that is already in the population (e.g., a child that
+   [mutate] returned unchanged) is copied so that it gets an [Oo.id] of its
+   own *)
+let ipop_add ipop rep =
+  let rep = if Hashtbl.mem ipop.slots (Oo.id rep) then rep#copy () else rep in
+  if ipop.size = Array.length ipop.individuals then
+    ipop.individuals <-
+      Array.append ipop.individuals (Array.make (max 1 ipop.size) rep) ;
+  ipop.individuals.(ipop.size) <- rep ;
+  hrep ipop.slots (Oo.id rep) ipop.size ;
+  ipop.size <- ipop.size + 1 ;
+  ipop.ranked <- FitnessRank.add (ipop_key rep) ipop.ranked
+
+let ipop_create pop =
+  let ipop =
+    { individuals = Array.of_list pop ; size = 0 ;
+      slots = Hashtbl.create (llen pop) ; ranked = FitnessRank.empty }
+  in
+  liter (ipop_add ipop) pop ;
+  ipop
+
+(* moves the last individual into the removed one's slot *)
+let ipop_remove ipop rep =
+  let slot = hfind ipop.slots (Oo.id rep) in
+  let last = ipop.size - 1 in
+  let moved = ipop.individuals.(last) in
+  ipop.individuals.(slot) <- moved ;
+  hrep ipop.slots (Oo.id moved) slot ;
+  ipop.individuals.(last) <- ipop.individuals.(0) ;
+  Hashtbl.remove ipop.slots (Oo.id rep) ;
+  ipop.size <- last ;
+  ipop.ranked <- FitnessRank.remove (ipop_key rep) ipop.ranked
+
+let ipop_random ipop = ipop.individuals.(Random.int ipop.size)
+
+let ipop_worst ipop =
+  ipop.individuals.(hfind ipop.slots (snd (FitnessRank.min_elt ipop.ranked)))
+
+(** @return [k] distinct individuals chosen at random, in time proportional to
+    [k] (for [k] much smaller than the population) *)
+let ipop_sample ipop k =
+  let rec pick chosen n =
+    if n = 0 then chosen
+    else
+      let i = Random.int ipop.size in
+      if IntSet.mem i chosen then pick chosen n
+      else pick (IntSet.add i chosen) (n - 1)
+  in
+  let chosen = pick IntSet.empty (min k ipop.size) in
+  lmap (fun i -> ipop.individuals.(i)) (IntSet.elements chosen)
+
+let ipop_to_list ipop = Array.to_list (Array.sub ipop.individuals 0 ipop.size)
+
 (**/**)
 let random atom_set =
   let elts = List.rev (List.rev_map fst (WeightSet.elements atom_set)) in
@@ -207,8 +294,8 @@ let note_success (rep : ('a,'b) Rep.representation)
       debug "\nRepair Name: %s\n" name ;
       debug "Test Cases Skipped: %S\n" (String.concat "," skipped) ;
       debug "Current Time: %f\n" (Unix.gettimeofday ()) ;
-      let subdir = add_subdir (Some("repair")) in
-      let filename = "repair"^ !Global.extension in
+      let subdir = add_subdir (Some(!repair_name)) in
+      let filename = !repair_name ^ !Global.extension in
       let filename = Filename.concat subdir filename in
       rep#output_source filename ;
       rep#note_success ();
@@ -470,6 +557,66 @@ let calculate_fitness generation orig variant =
     note_success variant orig generation;
   variant
 
+(** [in_workers workers f report xs] is [Global.parallel_iter_ordered] for
+    functions that may compile and test variants. Each worker compiles at most
+    one variant, so each gets its own source and executable names; workers
+    leave the on-disk test cache to this process. The test results and test
+    metrics each worker produces are merged into this process before
+    [report x (Some(result, evals))] is called, where [evals] is the number of
+    test evaluations the worker did. So is the best lower bound on fitness
+    that --sequential-fitness has seen. *)
+let in_workers workers f report xs =
+  let first_counter = !test_counter in
+  test_counter := first_counter + (llen xs) ;
+  parallel_iter_ordered workers (fun i x ->
+      test_counter := first_counter + i ;
+      no_test_cache := true ;
+      test_cache_journal := Some([]) ;
+      let metrics = Hashtbl.copy test_metrics_table in
+      let evals = num_test_evals_ignore_cache () in
+      let result = f x in
+      result, num_test_evals_ignore_cache () - evals,
+      test_cache_export (), test_metrics_export metrics,
+      !best_sequential_fitness
+    ) (fun x result ->
+      match result with
+      | Some(result, evals, entries, metrics, best) ->
+        test_cache_merge entries ;
+        test_metrics_merge metrics ;
+        best_sequential_fitness := max !best_sequential_fitness best ;
+        report x (Some(result, evals))
+      | None -> report x None
+    ) xs
+
+(** tests [variants] concurrently in worker processes (at most one per
+    processor, or --fitness-in-parallel if that is larger), so that a
+    following [calculate_fitness] replays the merged results rather than
+    running the tests again. The replay counts the test evaluations, so the
+    workers' counts are not added here.
+
+    Sampling draws on the random number generator, so each variant is
+    evaluated under its own seed, drawn here; the replay must use the same one
+    (see [calculate_prefetched]) to draw the same tests.
+
+    @return each variant paired with its seed *)
+let prefetch_fitness generation variants =
+  let seeded = lmap (fun variant -> Random.bits (), variant) variants in
+  let workers =
+    min (llen seeded) (max !fitness_in_parallel (Lazy.force num_processors))
+  in
+  in_workers workers
+    (fun (seed, variant) ->
+       with_seed seed (fun () -> ignore (test_fitness generation variant)))
+    (fun _ _ -> ())
+    seeded ;
+  seeded
+
+(** [calculate_fitness] for a variant evaluated by [prefetch_fitness], which
+    returned [seeded] *)
+let calculate_prefetched seeded generation orig variant =
+  let seed, _ = List.find (fun (_, v) -> v == variant) seeded in
+  with_seed seed (fun () -> calculate_fitness generation orig variant)
+
 (** prepares for GA by registering available mutations (including templates if
     applicable) and reducing the search space, and then generates the initial
     population, using [incoming_pop] if non-empty, or by randomly mutating the
@@ -643,36 +790,36 @@ let steady_state_ga (original : ('a,'b) Rep.representation) incoming_pop =
       write_fitness_log, (fun _ -> close_out chan)
     end
   in
-  let evict_two =
+  (* the population is indexed (see [indexed_population]) so that neither
+     selection nor eviction needs a pass over the whole population *)
+  let evict_one =
     match !eviction_strategy with
-    | "random" -> fun pop -> snd (split_nth (random_order pop) 2)
+    | "random" -> ipop_random
     | "tournament" ->
-      let remove_rep rep pop =
-        let id = Oo.id rep in
-        List.filter (fun r' -> (Oo.id r') <> id) pop
-      in
-      fun pop ->
-        let compare_func a b = GPPopulation.compare_fitness b a in
-        let loser = GPPopulation.one_tournament ~compare_func pop in
-        let pop = remove_rep loser pop in
-        let loser = GPPopulation.one_tournament ~compare_func pop in
-        remove_rep loser pop
-    | "worst" ->
-      fun pop -> snd (split_nth (List.sort GPPopulation.compare_fitness pop) 2)
+      let compare_func a b = GPPopulation.compare_fitness b a in
+      fun ipop -> GPPopulation.tournament_from ~compare_func (ipop_sample ipop)
+    | "worst" -> ipop_worst
     | _ -> failwith ("unrecognized eviction strategy: " ^ !eviction_strategy)
   in
   let get_fitness one =
     (Rep.num_test_evals_ignore_cache ()), (calculate_fitness (-1) original one)
   in
-  let rec run_ga (pop : ('a,'b) GPPopulation.t) original =
-    let parents = GPPopulation.selection pop 2 in
+  let rec run_ga ipop original =
+    let parents =
+      lmap (fun _ -> GPPopulation.tournament_from (ipop_sample ipop)) [1; 2] in
     let children = first_nth (GPPopulation.crossover parents original) 2 in
     let mutated = GPPopulation.map children (fun one -> mutate one) in
     let inserts = GPPopulation.map mutated get_fitness in
-    write_fitness_log pop inserts;
-    run_ga ((lmap snd inserts) @ (evict_two pop)) original
+    if !fitness_log <> "" then
+      write_fitness_log (ipop_to_list ipop) inserts;
+    ipop_remove ipop (evict_one ipop) ;
+    ipop_remove ipop (evict_one ipop) ;
+    liter (fun (_, rep) -> ipop_add ipop rep) inserts ;
+    run_ga ipop original
   in
-  genetic_algorithm_template run_ga original incoming_pop ;
+  genetic_algorithm_template
+    (fun pop original -> run_ga (ipop_create pop) original)
+    original incoming_pop ;
   cleanup ()
 
 (** {b gasga } is parametric with respect to a number of choices (e.g.,
@@ -706,9 +853,12 @@ let gasga (original : ('a,'b) Rep.representation) incoming_pop =
     else
       b', rep, w::pop
   in
-  let rec run_ga (pop : ('a,'b) GPPopulation.t) original =
+  let new_child pop original =
     let parents = GPPopulation.selection pop 2 in
-    let child = mutate (List.hd (GPPopulation.crossover parents original)) in
+    mutate (List.hd (GPPopulation.crossover parents original))
+  in
+  let rec run_ga (pop : ('a,'b) GPPopulation.t) original =
+    let child = new_child pop original in
     let _ = calculate_fitness 0 original child in
     let best, worst, pop = lfoldl ejection_fold (child, child, []) pop in
     (* if (best == worst), then we are evicting it out of the population, so
@@ -717,7 +867,58 @@ let gasga (original : ('a,'b) Rep.representation) incoming_pop =
       ignore (calculate_fitness 0 original best) ;
     run_ga pop original
   in
-  genetic_algorithm_template run_ga original incoming_pop
+  (* The batched variant creates [gasga_batch] children per step and tests them
+     concurrently with the resampling of the best individual that has not yet
+     been sampled [num_fitness_samples] times, then evicts as many of the worst
+     individuals. The population is ranked by fitness so that neither the best
+     nor the worst requires a pass over the population. *)
+  let run_ga_batched (pop : ('a,'b) GPPopulation.t) original =
+    let members = Hashtbl.create (llen pop) in
+    let ranked = ref FitnessRank.empty in
+    let resampled = ref FitnessRank.empty in
+    let key (rep : ('a,'b) Rep.representation) =
+      get_opt (rep#fitness()), Oo.id rep in
+    (* [mutate] can return its argument unchanged, so a child may be the same
+       object as a member (or as another child); such a child is copied so
+       that it gets an [Oo.id] of its own *)
+    let add rep =
+      let rep = if Hashtbl.mem members (Oo.id rep) then rep#copy () else rep in
+      hrep members (Oo.id rep) rep ;
+      ranked := FitnessRank.add (key rep) !ranked ;
+      if (rep#num_evals ()) < !num_fitness_samples then
+        resampled := FitnessRank.add (key rep) !resampled
+    in
+    let remove rep =
+      Hashtbl.remove members (Oo.id rep) ;
+      ranked := FitnessRank.remove (key rep) !ranked ;
+      resampled := FitnessRank.remove (key rep) !resampled
+    in
+    liter add pop ;
+    let rec step () =
+      let pop = hfold (fun _ rep pop -> rep :: pop) members [] in
+      let children = lmap (fun _ -> new_child pop original) (1 -- !gasga_batch) in
+      let best =
+        if FitnessRank.is_empty !resampled then []
+        else [hfind members (snd (FitnessRank.max_elt !resampled))]
+      in
+      let seeded = prefetch_fitness 0 (best @ children) in
+      let calculate = calculate_prefetched seeded 0 original in
+      liter (fun child -> add (calculate child)) children ;
+      liter (fun best ->
+          remove best ;
+          add (calculate best)
+        ) best ;
+      for i = 1 to !gasga_batch do
+        remove (hfind members (snd (FitnessRank.min_elt !ranked)))
+      done ;
+      step ()
+    in
+    step ()
+  in
+  if !gasga_batch > 1 then
+    genetic_algorithm_template run_ga_batched original incoming_pop
+  else
+    genetic_algorithm_template run_ga original incoming_pop
 
 (***********************************************************************)
 (** constructs a representation out of the genome as specified at the command
@@ -764,17 +965,38 @@ let pd_oracle_search (orig : ('a,'b) Rep.representation) (starting_genome : stri
 
 (***********************************************************************)
 (** Takes an input file (overloading starting genome because I suck) and creates
-    the specified variants in order *)
+    the specified variants in order. With [--sequence-workers], the variants
+    are built and tested in parallel worker processes, but are still reported
+    in order; the search stops at the first repair unless [--continue] is
+    given. *)
 
 let sequence (orig : ('a,'b) Rep.representation) (starting_genome : string) =
-  List.iter
-    (fun genome ->
-       debug "genome: %s\n" genome;
-       let variant = orig#copy() in
-       variant#load_genome_from_string genome;
-       if test_to_first_failure variant then
-         note_success variant orig (1)
-    ) (get_lines starting_genome)
+  let build genome =
+    let variant = orig#copy() in
+    variant#load_genome_from_string genome;
+    variant
+  in
+  let genomes = get_lines starting_genome in
+  if !sequence_workers <= 1 then
+    List.iter
+      (fun genome ->
+         debug "genome: %s\n" genome;
+         let variant = build genome in
+         if test_to_first_failure variant then
+           note_success variant orig (1)
+      ) genomes
+  else begin
+    let evaluate genome = test_to_first_failure (build genome) in
+    let report genome result =
+      debug "genome: %s\n" genome;
+      match result with
+      | Some(passed, evals) ->
+        add_test_evals evals ;
+        if passed then note_success (build genome) orig (1)
+      | None -> debug "search: sequence: worker failed on %s\n" genome
+    in
+    in_workers !sequence_workers evaluate report genomes
+  end
 
 
 
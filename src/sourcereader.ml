@@ -59,7 +59,75 @@ let _ =
     ]
 
 let source_code = ref [] (* Original source code *)
-let changed_source_code = ref [] (* Repaired code *)
+
+(* Line buffer
+ * The repaired code is kept in a gap buffer: an array of lines
+ * with a run of free slots (the gap) at the position of the most
+ * recent edit. Inserting or deleting a line at the gap is O(1), and
+ * moving the gap costs the distance it moves, so a change script
+ * whose edits come in line order is applied in a single pass over
+ * the file. *)
+type line_buffer = {
+  mutable text : string array ;
+  mutable gap_start : int ; (* first free slot *)
+  mutable gap_end : int ;   (* first used slot after the gap *)
+}
+
+let buffer_of_list lines =
+  let text = Array.of_list lines in
+  { text = text ; gap_start = Array.length text ; gap_end = Array.length text }
+
+let buffer_length buf =
+  (Array.length buf.text) - (buf.gap_end - buf.gap_start)
+
+(* move_gap
+ * Moves the gap so that it starts at (zero-based) line pos. *)
+let move_gap buf pos = begin
+  if pos < buf.gap_start then begin
+    let n = buf.gap_start - pos in
+    Array.blit buf.text pos buf.text (buf.gap_end - n) n;
+    buf.gap_start <- pos;
+    buf.gap_end <- buf.gap_end - n
+  end else if pos > buf.gap_start then begin
+    let n = pos - buf.gap_start in
+    Array.blit buf.text buf.gap_end buf.text buf.gap_start n;
+    buf.gap_start <- pos;
+    buf.gap_end <- buf.gap_end + n
+  end
+end
+
+(* buffer_insert
+ * Inserts a line so that it becomes (zero-based) line pos. *)
+let buffer_insert buf pos line = begin
+  if buf.gap_start = buf.gap_end then begin
+    let len = Array.length buf.text in
+    let grow = max 16 len in
+    let text = Array.make (len + grow) "" in
+    Array.blit buf.text 0 text 0 buf.gap_start;
+    Array.blit buf.text buf.gap_end text (buf.gap_end + grow)
+      (len - buf.gap_end);
+    buf.text <- text;
+    buf.gap_end <- buf.gap_end + grow
+  end;
+  move_gap buf pos;
+  buf.text.(buf.gap_start) <- line;
+  buf.gap_start <- buf.gap_start + 1
+end
+
+(* buffer_delete
+ * Removes (zero-based) line pos. *)
+let buffer_delete buf pos = begin
+  move_gap buf pos;
+  buf.text.(buf.gap_end) <- "";
+  buf.gap_end <- buf.gap_end + 1
+end
+
+let buffer_iter f buf = begin
+  for i = 0 to buf.gap_start - 1 do f buf.text.(i) done;
+  for i = buf.gap_end to (Array.length buf.text) - 1 do f buf.text.(i) done
+end
+
+let changed_source_code = ref (buffer_of_list []) (* Repaired code *)
 
 (* Used to keep track
  * of line location when
@@ -84,11 +152,15 @@ let pivot_line = ref max_int
  * from the last one to the first, the relative position array will
  * declare every modifier to be 0. This could result in out-of-bounds
  * insertions on an empty patch, or something like that. Even with
- * checks the behavior could be weird. Requires more thought. *)
-let relative_positions = ref []
+ * checks the behavior could be weird. Requires more thought.
+ *
+ * Every edit shifts all of the lines after it, so the positions are
+ * stored as a Fenwick tree of differences: shifting a suffix and
+ * looking up one position both take O(log n). *)
+let relative_positions = ref [| |]
 
 (* Keep track of inserts between lines, for poorly done scripts. *)
-let inserts_between_lines = ref []
+let inserts_between_lines = ref [| |]
 
 (* Holds the file name of the current file on which we're operating. *)
 let global_filename = ref ""
@@ -96,10 +168,10 @@ let global_filename = ref ""
 (* Used for multi-file repairs. This should be called between
  * processing scripts. *)
 let reset_data () = begin
-  relative_positions := [];
-  inserts_between_lines := [];
+  relative_positions := [| |];
+  inserts_between_lines := [| |];
   source_code := [];
-  changed_source_code := [];
+  changed_source_code := buffer_of_list [];
 end
 
 (* source_to_str_list
@@ -109,22 +181,11 @@ end
  * strings representing lines of code
  * INPUT: Source file name as a string *)
 let source_to_str_list filename = begin
-  let c = open_in filename in
-  try
-    while true do
-      let next_line = input_line c in
-      source_code := next_line :: !source_code;
-      changed_source_code := next_line :: !changed_source_code;
-      relative_positions := 0 :: !relative_positions;
-      inserts_between_lines := 0 :: !inserts_between_lines
-    done;
-    close_in c;
-  with
-    End_of_file -> close_in c;
-    source_code := (List.rev !source_code);
-    changed_source_code :=  (List.rev !changed_source_code);
-    inserts_between_lines := (List.tl !inserts_between_lines);
-    ()
+  source_code := get_lines filename;
+  changed_source_code := buffer_of_list !source_code;
+  let num_lines = List.length !source_code in
+  relative_positions := Array.make num_lines 0;
+  inserts_between_lines := Array.make (max 0 (num_lines - 1)) 0
 end
 
 (* print_original_file
@@ -139,13 +200,30 @@ end
 
 (* print_changed_file
  * Prints out the changed_source_code
- * string list, mimicking the
+ * buffer, mimicking the
  * altered source code from the original
  * file. *)
 let print_changed_file () = begin
   let count = ref 1 in
-  List.iter (fun x -> Printf.printf "%d: %s\n" !count x; incr count
-            ) !changed_source_code
+  buffer_iter (fun x -> Printf.printf "%d: %s\n" !count x; incr count
+              ) !changed_source_code
+end
+
+(* get_position
+ * Looks up the relative position of an original line: the sum
+ * of the Fenwick tree entries up to it.
+ * INPUT: Line number (int) *)
+let get_position line_number = begin
+  let tree = !relative_positions in
+  if line_number < 0 || line_number >= Array.length tree then
+    invalid_arg "get_position";
+  let sum = ref 0 in
+  let i = ref (line_number + 1) in
+  while !i > 0 do
+    sum := !sum + tree.(!i - 1);
+    i := !i - (!i land (- !i))
+  done;
+  !sum
 end
 
 (* modify_positions
@@ -156,29 +234,24 @@ end
  * it are modified (int)
  * INPUT: Modifier (always -1 or 1, int) *)
 let modify_positions line_number num = begin
-  let count = ref 0 in
-  relative_positions :=
-    List.map(fun x ->
-        if (!count)>line_number then (x+num)
-        else (incr count; x)
-      ) !relative_positions
+  let tree = !relative_positions in
+  let i = ref ((max 0 (line_number + 1)) + 1) in
+  while !i <= Array.length tree do
+    tree.(!i - 1) <- tree.(!i - 1) + num;
+    i := !i + (!i land (- !i))
+  done
 end
 
 (* modify_inserts
  * Adjust the number of inserts between two lines
- * (really after a line). Always going to do +1
- * but I don't know a better way of just changing
- * the nth position so I'll just do it insanely
- * inefficiently for now.
+ * (really after a line).
  * INPUT: Line number; modifies the line number - 1
  * position in the buffer by +1 *)
 let modify_inserts line_number = begin
-  let count = ref 0 in
-  inserts_between_lines :=
-    List.map(fun x ->
-        if (!count)=(line_number-1) then (incr count; (x+1))
-        else (incr count; x)
-      ) !inserts_between_lines
+  let inserts = !inserts_between_lines in
+  let i = line_number - 1 in
+  if i >= 0 && i < Array.length inserts then
+    inserts.(i) <- inserts.(i) + 1
 end
 (* debug_tuple
  * Print out the action tuples. *)
@@ -192,36 +265,19 @@ let debug_tuple tup = begin
     ) tup
 end
 
-(* insert_line_helper
- * Does the actual insertion for insert_line via recursion and pattern matching.
- * INPUT: (always !changed_source_code)
- * INPUT: Line of code to insert as string
- * INPUT: Line number where code is to be inserted *)
-let rec insert_line_helper (theList : string list) line line_number = begin
-  if ( line_number = 1 ) then line::theList else
-    match theList with
-      []  -> []
-    |   h::t    -> h::( insert_line_helper t line (line_number - 1))
-end
-
 (* insert_line
  * Insert a line of code into the modified code.
  * Assumption: We want it inserted at line x where x
- * is a line from the ORIGINAL source code.
+ * is a line from the ORIGINAL source code. Positions
+ * outside the modified code are ignored.
  * INPUT: Line of code to insert as string
  * INPUT: Line number where code is to be inserted *)
 let insert_line line line_number = begin
-  let modifier = List.nth !relative_positions line_number in
-  (*
-    if (line_number>(!pivot_line)) then (!global_line_adjustment)
-    else 0
-    in
-    (pivot_line :=
-    if (line_number<=(!pivotline)) then line_number
-    else !pivote_line);
-  *)
-  changed_source_code :=
-    (insert_line_helper !changed_source_code line (line_number + modifier + 1));
+  let modifier = get_position line_number in
+  let buf = !changed_source_code in
+  let pos = line_number + modifier in
+  if pos >= 0 && pos <= buffer_length buf then
+    buffer_insert buf pos line;
   modify_positions line_number 1
 end
 
@@ -234,36 +290,21 @@ let insert_line_list line_list line_number = begin
             ) line_list
 end
 
-(* delete_line_helper
- * Does the actual deletion for delete_line via recursion and pattern matching.
- * INPUT: (always !changed_source_code)
- * INPUT: Line number where code is to be deleted *)
-let rec delete_line_helper (theList : string list) line_number = begin
-  match theList with
-    []  -> []
-  |   h::t    -> if ( line_number = 1) then t
-    else h::( delete_line_helper t ( line_number - 1) )
-end
-
 (* delete_line
  * Delete a line of code from the modified code.
  * Assumption: We want it deleted at line x where x
- * is a line from the original source file
+ * is a line from the original source file. Positions
+ * outside the modified code are ignored.
  * INPUT: line number to delete *)
 let delete_line line_number = begin
-  let modifier =
-    (List.nth !relative_positions line_number) +
-    (List.nth !inserts_between_lines line_number) in
-  (*
-    if (line_number>(!pivot_line)) then (!global_line_adjustment)
-    else 0
-    in
-    (pivot_line :=
-    if (line_number<=(!pivot_line)) then line_number
-    else !pivot_line);
-  *)
-  changed_source_code :=
-    (delete_line_helper !changed_source_code (line_number + modifier));
+  let inserts = !inserts_between_lines in
+  if line_number < 0 || line_number >= Array.length inserts then
+    invalid_arg "delete_line";
+  let modifier = (get_position line_number) + inserts.(line_number) in
+  let buf = !changed_source_code in
+  let pos = line_number + modifier - 1 in
+  if pos >= 0 && pos < buffer_length buf then
+    buffer_delete buf pos;
   modify_positions line_number (-1) ;
   modify_inserts line_number
 end
@@ -375,7 +416,7 @@ let write_file filename = begin
   let output_name = "Change_Original/"^base^".repaired."^ext in
   ensure_directories_exist output_name;
   let oc = open_out output_name in
-  List.iter(fun x ->
+  buffer_iter (fun x ->
       Printf.fprintf oc "%s\n" x) !changed_source_code;
   close_out oc
 end
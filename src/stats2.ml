@@ -52,11 +52,18 @@ let stack = ref []
 let totals = Hashtbl.create 255
 let invocations = Hashtbl.create 255
 
+(* CPU time (user + system) used by child processes, by activity, and the
+   number of children; see [child_cpu_time] and [note_child] *)
+let child_totals = Hashtbl.create 255
+let child_counts = Hashtbl.create 255
+
 let load_started = ref (Unix.gettimeofday ())
 
 let clear () =
   Hashtbl.clear totals ;
   Hashtbl.clear invocations ;
+  Hashtbl.clear child_totals ;
+  Hashtbl.clear child_counts ;
   stack := [] ;
   load_started := Unix.gettimeofday ()
 
@@ -92,6 +99,21 @@ let time name f a =
     finished () ;
     raise e
 
+(* The CPU time used so far by the children of this process that have
+   terminated and been waited for, including their own waited-for children.
+   Because a child's time is added when it is reaped, the difference across
+   one [wait] is exactly the time of the child it reaped, however many other
+   processes were running meanwhile. *)
+let child_cpu_time () =
+  let t = Unix.times () in
+  t.Unix.tms_cutime +. t.Unix.tms_cstime
+
+let note_child name cpu =
+  Hashtbl.replace child_totals name
+    (cpu +. (try Hashtbl.find child_totals name with Not_found -> 0.0)) ;
+  Hashtbl.replace child_counts name
+    (1 + (try Hashtbl.find child_counts name with Not_found -> 0))
+
 let hashtbl_to_list ht =
   let lst = ref [] in
   Hashtbl.iter (fun  a b -> lst := (a,b) :: !lst) ht ;
@@ -116,4 +138,35 @@ let print chn msg =
   let now = Unix.gettimeofday () in
   let delta = now -. (!load_started) in
   Printf.fprintf chn "  %-30s          %7.3f = %g%% (avg CPU usage)\n" "TOTAL"
-    total (100. *. total /. delta)
+    total (100. *. total /. delta) ;
+  let children = hashtbl_to_list child_totals in
+  if children <> [] then begin
+    Printf.fprintf chn "  %-30s %8s %7s\n"
+      "Child Process Activity" "Count" "CPU Sec" ;
+    List.iter (fun (l,t) ->
+        Printf.fprintf chn "  %-30s %8d %7.3f\n" l
+          (Hashtbl.find child_counts l) t
+      ) (List.sort (fun (_,at) (_,bt) -> compare at bt) children)
+  end ;
+  (* the collector: how often it ran, then the heap sizes and the data it
+     promoted from the minor heap to the major one *)
+  let gc = Gc.quick_stat () in
+  let ctrl = Gc.get () in
+  let mb words = words *. float_of_int (Sys.word_size / 8) /. 1048576.0 in
+  Printf.fprintf chn "  %-30s %8s %7s\n" "Garbage Collection" "Count" "MB" ;
+  List.iter (fun (l,n) ->
+      Printf.fprintf chn "  %-30s %8d\n" l n
+    ) [
+    "minor collections", gc.Gc.minor_collections ;
+    "major collections", gc.Gc.major_collections ;
+    "compactions", gc.Gc.compactions ;
+  ] ;
+  List.iter (fun (l,words) ->
+      Printf.fprintf chn "  %-30s %8s %7.1f\n" l "" (mb words)
+    ) [
+    "minor heap", float_of_int ctrl.Gc.minor_heap_size ;
+    "major heap", float_of_int gc.Gc.heap_words ;
+    "largest major heap", float_of_int gc.Gc.top_heap_words ;
+    "promoted", gc.Gc.promoted_words ;
+  ] ;
+  Printf.fprintf chn "  %-30s %8d%%\n" "space overhead" ctrl.Gc.space_overhead
@@ -118,7 +118,7 @@ class stringRep = object (self : 'self_type)
 
   method set_genome g =
     self#updated ();
-    history := g;
+    self#reset_history (lmap (fun h -> h, self#history_element_to_str h) g) ;
     genome <- g
 
   method add_history h =
@@ -130,11 +130,7 @@ class stringRep = object (self : 'self_type)
 
   method atom_to_str line = line
 
-  method name () =
-    if genome = [] then "original"
-    else
-      let strs = lmap self#history_element_to_str genome in
-      String.concat " " strs
+  method private render_name parts = String.concat " " parts
 
   method load_genome_from_string str =
     let scan_history_element b =